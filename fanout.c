@@ -0,0 +1,550 @@
+/*
+  Local fan-out of the received data for NTRIP client for POSIX.
+  $Id$
+  Copyright (C) 2026 by the ntripclient contributors
+  <https://github.com/nunojpg/ntripclient>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+  or read http://www.gnu.org/licenses/gpl.txt
+*/
+
+#ifndef WINDOWSVERSION
+/* system includes */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#define HAVE_FANOUT
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* The received data is served to local TCP and Unix socket clients by a
+   separate thread. Each received block is stored once and linked into a
+   list, it counts the clients which still have to send it and is freed
+   by the last one. A client which falls more than FANOUTBACKLOG bytes
+   behind is dropped, so slow clients never stop the network reception.
+   New clients get the latest static RTCM3 messages first. */
+#define FANOUTLISTEN   4      /* listening sockets */
+#define FANOUTCLIENTS  64
+#define FANOUTBACKLOG  65536  /* bytes a client may fall behind */
+#define FANOUTIOV      16     /* blocks sent with one call */
+#define FANOUTSTATIC   4
+
+/* station position, antenna and receiver description, GLONASS biases */
+static const int fanoutstatic[FANOUTSTATIC] = {1005, 1006, 1033, 1230};
+
+struct fanblock
+{
+  struct fanblock *next;
+  int              refs;     /* clients which did not send the block yet */
+  int              size;
+  char             data[];
+};
+
+struct fanclient
+{
+  int              fd;       /* -1 for an unused entry */
+  struct fanblock *pos;      /* next block to send, 0 waits for a new one */
+  int              ofs;      /* bytes of pos already sent */
+  size_t           queued;   /* bytes not yet sent */
+  int              drop;     /* 1 closed, 2 too slow */
+  char            *cache;    /* static messages sent before the blocks */
+  int              cachesize;
+  int              cacheofs;
+};
+
+struct fanout
+{
+  int              listen[FANOUTLISTEN];
+  const char      *path[FANOUTLISTEN]; /* Unix sockets removed at the end */
+  int              numlisten;
+  struct fanclient client[FANOUTCLIENTS];
+  int              clients;
+  struct fanblock *head;
+  struct fanblock *tail;
+  struct
+  {
+    int            size;
+    unsigned char  data[RTCM3MAXFRAME];
+  } cache[FANOUTSTATIC];
+  struct rtcm3     rtcm3;    /* frame search when the output is not framed */
+  int              scan;
+  int              wake[2];  /* pipe interrupting poll() */
+  int              woken;
+  int              quit;
+  unsigned long    accepted;
+  unsigned long    dropped;
+  pthread_t        thread;
+  pthread_mutex_t  mutex;
+};
+
+/* decrements the references from block b on and frees unused blocks */
+static void FanoutRelease(struct fanout *f, struct fanblock *b,
+struct fanblock *end)
+{
+  for(; b != end; b = b->next)
+    --b->refs;
+  /* blocks are sent in order, so unused ones are always at the head */
+  while(f->head && !f->head->refs)
+  {
+    b = f->head;
+    if(!(f->head = b->next))
+      f->tail = 0;
+    free(b);
+  }
+}
+
+static void FanoutDrop(struct fanout *f, struct fanclient *c)
+{
+  FanoutRelease(f, c->pos, 0);
+  close(c->fd);
+  free(c->cache);
+  c->fd = -1;
+  c->cache = 0;
+  --f->clients;
+}
+
+static void FanoutAccept(struct fanout *f, int sock)
+{
+  struct fanclient *c = 0;
+  int fd, i, size = 0, one = 1, sndbuf = FANOUTBACKLOG;
+
+  if((fd = accept(sock, 0, 0)) < 0)
+    return;
+  for(i = 0; i < FANOUTCLIENTS && !c; ++i)
+  {
+    if(f->client[i].fd == -1)
+      c = &f->client[i];
+  }
+  if(!c)
+  {
+    close(fd);
+    return;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  /* otherwise the kernel buffers megabytes before a client counts as slow */
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  memset(c, 0, sizeof(*c));
+  c->fd = fd;
+  for(i = 0; i < FANOUTSTATIC; ++i)
+    size += f->cache[i].size;
+  if(size && (c->cache = malloc(size)))
+  {
+    for(i = 0; i < FANOUTSTATIC; ++i)
+    {
+      memcpy(c->cache+c->cachesize, f->cache[i].data, f->cache[i].size);
+      c->cachesize += f->cache[i].size;
+    }
+  }
+  ++f->clients;
+  ++f->accepted;
+}
+
+/* sends as much as possible without blocking, returns -1 on errors */
+static int FanoutSend(struct fanout *f, struct fanclient *c)
+{
+  for(;;)
+  {
+    struct iovec iov[FANOUTIOV];
+    struct msghdr msg;
+    struct fanblock *b = c->pos;
+    int num = 0, ofs = c->ofs;
+    ssize_t n;
+
+    if(c->cacheofs < c->cachesize)
+    {
+      iov[num].iov_base = c->cache+c->cacheofs;
+      iov[num++].iov_len = c->cachesize-c->cacheofs;
+    }
+    for(; b && num < FANOUTIOV; b = b->next, ofs = 0)
+    {
+      iov[num].iov_base = b->data+ofs;
+      iov[num++].iov_len = b->size-ofs;
+    }
+    if(!num)
+      return 0;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = num;
+    if((n = sendmsg(c->fd, &msg, MSG_NOSIGNAL|MSG_DONTWAIT)) < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+      ? 0 : -1;
+    if(c->cacheofs < c->cachesize)
+    {
+      int m = c->cachesize-c->cacheofs;
+      if(m > n)
+        m = n;
+      c->cacheofs += m;
+      n -= m;
+    }
+    b = c->pos;
+    c->queued -= n;
+    while(b && n >= b->size-c->ofs)
+    {
+      n -= b->size-c->ofs;
+      c->ofs = 0;
+      b = b->next;
+    }
+    if(b)
+      c->ofs += n;
+    FanoutRelease(f, c->pos, b);
+    c->pos = b;
+    if(c->ofs || c->cacheofs < c->cachesize)
+      return 0; /* socket buffer is full */
+  }
+}
+
+static void *FanoutThread(void *data)
+{
+  struct fanout *f = data;
+  struct pollfd p[1+FANOUTLISTEN+FANOUTCLIENTS];
+  int map[FANOUTCLIENTS];
+
+  for(;;)
+  {
+    int n = 0, num = 0, i;
+    char c[64];
+
+    pthread_mutex_lock(&f->mutex);
+    if(f->quit)
+    {
+      pthread_mutex_unlock(&f->mutex);
+      break;
+    }
+    p[n].fd = f->wake[0];
+    p[n++].events = POLLIN;
+    for(i = 0; i < f->numlisten; ++i)
+    {
+      p[n].fd = f->listen[i];
+      p[n++].events = POLLIN;
+    }
+    for(i = 0; i < FANOUTCLIENTS; ++i)
+    {
+      struct fanclient *cl = &f->client[i];
+      if(cl->fd == -1)
+        continue;
+      map[num++] = i;
+      p[n].fd = cl->fd;
+      /* clients do not send, readable means closed or garbage */
+      p[n++].events = POLLIN | (cl->pos || cl->cacheofs < cl->cachesize
+      ? POLLOUT : 0);
+    }
+    pthread_mutex_unlock(&f->mutex);
+
+    if(poll(p, n, -1) < 0)
+    {
+      if(errno != EINTR)
+        break;
+      continue;
+    }
+
+    pthread_mutex_lock(&f->mutex);
+    if(p[0].revents)
+    {
+      while(read(f->wake[0], c, sizeof(c)) > 0)
+        ;
+      f->woken = 0;
+    }
+    for(i = 0; i < num; ++i)
+    {
+      struct fanclient *cl = &f->client[map[i]];
+      short r = p[1+f->numlisten+i].revents;
+      if(!cl->drop && (r & (POLLIN|POLLERR|POLLHUP)))
+      {
+        ssize_t j = recv(cl->fd, c, sizeof(c), MSG_DONTWAIT);
+        if(!j || (j < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+        && errno != EINTR))
+          cl->drop = 1;
+      }
+      if(!cl->drop && (r & POLLOUT) && FanoutSend(f, cl) < 0)
+        cl->drop = 1;
+    }
+    for(i = 0; i < FANOUTCLIENTS; ++i)
+    {
+      if(f->client[i].fd != -1 && f->client[i].drop)
+      {
+        if(f->client[i].drop == 2)
+          ++f->dropped;
+        FanoutDrop(f, &f->client[i]);
+      }
+    }
+    for(i = 0; i < f->numlisten; ++i)
+    {
+      if(p[1+i].revents & POLLIN)
+        FanoutAccept(f, f->listen[i]);
+    }
+    pthread_mutex_unlock(&f->mutex);
+  }
+  return 0;
+}
+
+/* Opens a non-blocking listening socket for "port", "host:port",
+   "[address]:port" or an absolute Unix socket path. Returns an error
+   message or 0. */
+static const char *FanoutSocket(const char *address, int *listensock)
+{
+  int sock = -1, one = 1;
+
+  if(*address == '/')
+  {
+    struct sockaddr_un un;
+    struct stat st;
+
+    if(strlen(address) >= sizeof(un.sun_path))
+      return "Unix socket path too long";
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, address);
+    /* a socket left over by an earlier run */
+    if(!stat(address, &st) && S_ISSOCK(st.st_mode))
+      unlink(address);
+    if((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+    || bind(sock, (struct sockaddr *)&un, sizeof(un)) < 0)
+    {
+      if(sock >= 0)
+        close(sock);
+      return "could not bind Unix socket";
+    }
+  }
+  else
+  {
+    struct addrinfo hints, *res, *ai;
+    char host[256];
+    const char *port = strrchr(address, ':');
+    int pass;
+
+    host[0] = 0;
+    if(port)
+    {
+      int l = port-address;
+      if(*address == '[' && l >= 2 && address[l-1] == ']')
+        snprintf(host, sizeof(host), "%.*s", l-2, address+1);
+      else
+        snprintf(host, sizeof(host), "%.*s", l, address);
+      ++port;
+    }
+    else
+      port = address;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if(getaddrinfo(*host ? host : 0, port, &hints, &res))
+      return "could not resolve listening address";
+    /* without a host the IPv6 wildcard accepts IPv4 as well */
+    for(pass = 0; pass < 2 && sock < 0; ++pass)
+    {
+      for(ai = res; ai && sock < 0; ai = ai->ai_next)
+      {
+        if((ai->ai_family == AF_INET6) != !pass)
+          continue;
+        if((sock = socket(ai->ai_family, SOCK_STREAM, 0)) < 0)
+          continue;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(ai->ai_family == AF_INET6 && !*host)
+        {
+          int zero = 0;
+          setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        }
+        if(bind(sock, ai->ai_addr, ai->ai_addrlen) < 0)
+        {
+          close(sock);
+          sock = -1;
+        }
+      }
+    }
+    freeaddrinfo(res);
+    if(sock < 0)
+      return "could not bind listening address";
+  }
+  if(listen(sock, 16) < 0)
+  {
+    close(sock);
+    return "could not listen";
+  }
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+  *listensock = sock;
+  return 0;
+}
+
+static const char *FanoutListen(struct fanout *f, const char *address)
+{
+  const char *e;
+
+  if(f->numlisten >= FANOUTLISTEN)
+    return "too many listening sockets";
+  if(!(e = FanoutSocket(address, &f->listen[f->numlisten])))
+  {
+    if(*address == '/')
+      f->path[f->numlisten] = address;
+    ++f->numlisten;
+  }
+  return e;
+}
+
+static void FanoutClose(struct fanout *f)
+{
+  int i;
+
+  for(i = 0; i < f->numlisten; ++i)
+  {
+    close(f->listen[i]);
+    if(f->path[i])
+      unlink(f->path[i]);
+  }
+  for(i = 0; i < FANOUTCLIENTS; ++i)
+  {
+    if(f->client[i].fd != -1)
+      FanoutDrop(f, &f->client[i]);
+  }
+  if(f->wake[0] != -1)
+  {
+    close(f->wake[0]);
+    close(f->wake[1]);
+  }
+  f->numlisten = 0;
+}
+
+/* Opens the listening sockets and starts the sending thread. With scan
+   set the data is searched for static RTCM3 messages, otherwise
+   FanoutFrame() must be called for the frames. */
+static const char *FanoutStart(struct fanout *f, const char * const *address,
+int num, int scan)
+{
+  const char *e = 0;
+  int i;
+
+  memset(f, 0, sizeof(*f));
+  f->wake[0] = f->wake[1] = -1;
+  for(i = 0; i < FANOUTCLIENTS; ++i)
+    f->client[i].fd = -1;
+  for(i = 0; i < num && !e; ++i)
+    e = FanoutListen(f, address[i]);
+  if(!e && pipe(f->wake))
+    e = "could not create pipe";
+  if(e)
+  {
+    FanoutClose(f);
+    return e;
+  }
+  fcntl(f->wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(f->wake[1], F_SETFL, O_NONBLOCK);
+  Rtcm3Init();
+  f->scan = scan;
+  pthread_mutex_init(&f->mutex, 0);
+  if(pthread_create(&f->thread, 0, FanoutThread, f))
+  {
+    pthread_mutex_destroy(&f->mutex);
+    FanoutClose(f);
+    return "could not start fan-out thread";
+  }
+  return 0;
+}
+
+static void FanoutWake(struct fanout *f)
+{
+  if(!f->woken)
+  {
+    f->woken = 1;
+    if(write(f->wake[1], "", 1) < 0)
+      f->woken = 0;
+  }
+}
+
+/* stops the thread and disconnects all clients */
+static void FanoutStop(struct fanout *f)
+{
+  pthread_mutex_lock(&f->mutex);
+  f->quit = 1;
+  FanoutWake(f);
+  pthread_mutex_unlock(&f->mutex);
+  pthread_join(f->thread, 0);
+  pthread_mutex_destroy(&f->mutex);
+  FanoutClose(f);
+}
+
+/* keeps the frame when it is one of the static messages */
+static void FanoutFrame(struct fanout *f, const unsigned char *frame,
+int size)
+{
+  int i, type = Rtcm3Type(frame, size);
+
+  for(i = 0; i < FANOUTSTATIC; ++i)
+  {
+    if(fanoutstatic[i] == type)
+    {
+      pthread_mutex_lock(&f->mutex);
+      memcpy(f->cache[i].data, frame, size);
+      f->cache[i].size = size;
+      pthread_mutex_unlock(&f->mutex);
+      break;
+    }
+  }
+}
+
+/* hands the data to all clients */
+static void FanoutWrite(struct fanout *f, const char *buf, int size)
+{
+  struct fanblock *b = 0;
+  int i;
+
+  if(f->scan)
+  {
+    const unsigned char *frame;
+    const char *in = buf;
+    int left = size, n;
+    while((n = Rtcm3Next(&f->rtcm3, &in, &left, &frame)))
+      FanoutFrame(f, frame, n);
+  }
+  pthread_mutex_lock(&f->mutex);
+  if(size && f->clients && (b = malloc(sizeof(*b)+size)))
+  {
+    memcpy(b->data, buf, size);
+    b->size = size;
+    b->next = 0;
+    b->refs = f->clients;
+    if(f->tail)
+      f->tail->next = b;
+    else
+      f->head = b;
+    f->tail = b;
+    for(i = 0; i < FANOUTCLIENTS; ++i)
+    {
+      struct fanclient *c = &f->client[i];
+      if(c->fd == -1)
+        continue;
+      if(!c->pos)
+        c->pos = b;
+      if((c->queued += size) > FANOUTBACKLOG && !c->drop)
+        c->drop = 2;
+    }
+    FanoutWake(f);
+  }
+  pthread_mutex_unlock(&f->mutex);
+}
+#endif /* WINDOWSVERSION */
@@ -0,0 +1,121 @@
+/*
+  Merging of redundant RTCM3 streams for NTRIP client for POSIX.
+  $Id$
+  Copyright (C) 2026 by the ntripclient contributors
+  <https://github.com/nunojpg/ntripclient>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+  or read http://www.gnu.org/licenses/gpl.txt
+*/
+
+/* system includes */
+#include <string.h>
+
+/* The same stream received over several paths is passed on frame by
+   frame as the first copy arrives. A frame is known by its length, its
+   checksum and its first 8 bytes, which hold message type, station and
+   epoch of the observation messages. The frames of the last MERGEWINDOW
+   ms are kept in a hash table. A copy from another path is dropped, the
+   same frame again from the same path is a repeated message (e.g. the
+   station position) and passed on. */
+#define MERGEPATHS  2
+#define MERGESLOTS  4096   /* power of 2 */
+#define MERGEPROBE  4      /* slots searched for a frame */
+#define MERGEWINDOW 5000   /* ms a copy may be late */
+#define MERGEHEAD   8
+
+struct mergeframe
+{
+  double        arrival;  /* ms, 0 for an unused slot */
+  unsigned long crc;
+  int           size;
+  int           path;     /* path of the first copy, -1 after the second */
+  unsigned char head[MERGEHEAD];
+};
+
+struct mergepath
+{
+  unsigned long frames;   /* frames received */
+  unsigned long first;    /* frames passed on */
+  unsigned long late;     /* copies dropped */
+  double        lag;      /* summed ms the dropped copies were late */
+  double        maxlag;
+};
+
+struct merge
+{
+  struct mergeframe slot[MERGESLOTS];
+  struct mergepath  path[MERGEPATHS];
+  unsigned long     forgotten; /* frames replaced before their time */
+};
+
+static void MergeInit(struct merge *m)
+{
+  memset(m, 0, sizeof(*m));
+}
+
+/* returns 1 when the frame received over path at the time now (ms) is to
+   be passed on and 0 for a copy */
+static int MergeFrame(struct merge *m, int path, const unsigned char *frame,
+int size, double now)
+{
+  unsigned long crc = ((unsigned long)frame[size-3] << 16)
+  | (frame[size-2] << 8) | frame[size-1];
+  unsigned char head[MERGEHEAD];
+  struct mergeframe *f, *use = 0;
+  int h = (crc ^ (crc >> 12)) & (MERGESLOTS-1), i;
+
+  memset(head, 0, sizeof(head));
+  memcpy(head, frame+3, size-6 < MERGEHEAD ? size-6 : MERGEHEAD);
+  ++m->path[path].frames;
+  for(i = 0; i < MERGEPROBE; ++i)
+  {
+    f = &m->slot[(h+i) & (MERGESLOTS-1)];
+    if(!f->arrival || now - f->arrival > MERGEWINDOW)
+    {
+      if(!use)
+        use = f;
+    }
+    else if(f->crc == crc && f->size == size
+    && !memcmp(f->head, head, MERGEHEAD))
+    {
+      if(f->path >= 0 && f->path != path)
+      {
+        struct mergepath *p = &m->path[path];
+        double lag = now - f->arrival;
+        ++p->late;
+        p->lag += lag;
+        if(lag > p->maxlag)
+          p->maxlag = lag;
+        f->path = -1;
+        return 0;
+      }
+      use = f; /* repeated message */
+      break;
+    }
+  }
+  if(!use)
+  {
+    use = &m->slot[h];
+    ++m->forgotten;
+  }
+  use->arrival = now;
+  use->crc = crc;
+  use->size = size;
+  use->path = path;
+  memcpy(use->head, head, MERGEHEAD);
+  ++m->path[path].first;
+  return 1;
+}
@@ -0,0 +1,481 @@
+/*
+  Metrics endpoint for NTRIP client for POSIX.
+  $Id$
+  Copyright (C) 2026 by the ntripclient contributors
+  <https://github.com/nunojpg/ntripclient>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+  or read http://www.gnu.org/licenses/gpl.txt
+*/
+
+#ifdef HAVE_FANOUT
+/* system includes */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#define HAVE_METRICS
+
+/* The counters of each stream are updated by the receiving code with
+   relaxed atomic operations, which cost no more than a normal addition.
+   A separate thread answers HTTP requests with the current values in
+   the Prometheus text format. */
+#define METRICSSIZES      7
+#define METRICSHANDSHAKES 8
+#define METRICSREQUEST    4096
+#define METRICSQUANTILES  3
+#define METRICSEPOCHS     8
+
+/* upper bounds of the histogram buckets, a last bucket takes the rest */
+static const unsigned long metricssizes[METRICSSIZES] =
+{16, 64, 256, 1024, 4096, 16384, 65536};
+static const double metricshandshakes[METRICSHANDSHAKES] = /* seconds */
+{0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+static const double metricsquantiles[METRICSQUANTILES] = {0.5, 0.9, 0.99};
+static const double metricsepochs[METRICSEPOCHS] = /* seconds */
+{0.25, 0.5, 0.75, 1, 1.5, 2, 3, 5};
+
+struct metrics
+{
+  struct metrics *next;
+  const char     *mountpoint;
+  atomic_ulong    bytes;
+  atomic_ulong    recvsize[METRICSSIZES+1];
+  atomic_ulong    reconnects;
+  atomic_ulong    handshake[METRICSHANDSHAKES+1];
+  atomic_ulong    handshakeus; /* sum of all handshake times */
+  atomic_llong    lastdata;    /* ms, 0 before any data */
+  atomic_ulong    chunkerrors;
+  atomic_ulong    serialbacklog;
+  atomic_ulong    nmea;
+  atomic_ulong    nmeaerrors;
+  atomic_ulong    epoch[METRICSEPOCHS+1];
+  atomic_ulong    epochms;     /* sum of all completion times */
+  atomic_ulong    epochsincomplete;
+  /* correction ages are published at most once a second */
+  pthread_mutex_t agelock;
+  int             agetypes;
+  struct
+  {
+    int           type;
+    long          quantile[METRICSQUANTILES]; /* ms */
+    unsigned long count;
+    double        sum;
+  } age[RTCM3AGETYPES];
+};
+
+struct metricsserver
+{
+  struct metrics *list;
+  const char     *address;
+  int             sock;
+  int             wake[2];
+  pthread_t       thread;
+};
+
+#define METRICSADD(m, field, n) \
+  atomic_fetch_add_explicit(&(m)->field, (n), memory_order_relaxed)
+
+static long long MetricsTime(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1000LL + t.tv_nsec/1000000;
+}
+
+static void MetricsInit(struct metrics *m, const char *mountpoint)
+{
+  memset(m, 0, sizeof(*m));
+  m->mountpoint = mountpoint;
+  pthread_mutex_init(&m->agelock, 0);
+}
+
+static void MetricsRecv(struct metrics *m, int size)
+{
+  int i;
+
+  if(!m || size <= 0)
+    return;
+  for(i = 0; i < METRICSSIZES && (unsigned long)size > metricssizes[i]; ++i)
+    ;
+  METRICSADD(m, bytes, size);
+  METRICSADD(m, recvsize[i], 1);
+  atomic_store_explicit(&m->lastdata, MetricsTime(), memory_order_relaxed);
+}
+
+static void MetricsReconnect(struct metrics *m)
+{
+  if(m)
+    METRICSADD(m, reconnects, 1);
+}
+
+/* time from the start of the connection until the response header */
+static void MetricsHandshake(struct metrics *m, double ms)
+{
+  int i;
+
+  if(!m)
+    return;
+  for(i = 0; i < METRICSHANDSHAKES && ms > metricshandshakes[i]*1000; ++i)
+    ;
+  METRICSADD(m, handshake[i], 1);
+  METRICSADD(m, handshakeus, (unsigned long)(ms*1000));
+}
+
+static void MetricsChunkError(struct metrics *m)
+{
+  if(m)
+    METRICSADD(m, chunkerrors, 1);
+}
+
+static void MetricsBacklog(struct metrics *m, size_t size)
+{
+  if(m)
+    atomic_store_explicit(&m->serialbacklog, size, memory_order_relaxed);
+}
+
+static void MetricsNmea(struct metrics *m)
+{
+  if(m)
+    METRICSADD(m, nmea, 1);
+}
+
+static void MetricsNmeaError(struct metrics *m)
+{
+  if(m)
+    METRICSADD(m, nmeaerrors, 1);
+}
+
+/* an epoch was written, complete or not */
+static void MetricsEpoch(struct metrics *m, const struct rtcm3epoch *e)
+{
+  long ms = e->completion > 0 ? e->completion : 0;
+  int i;
+
+  if(!m)
+    return;
+  if(!e->done)
+  {
+    METRICSADD(m, epochsincomplete, 1);
+    return;
+  }
+  for(i = 0; i < METRICSEPOCHS && ms > metricsepochs[i]*1000; ++i)
+    ;
+  METRICSADD(m, epoch[i], 1);
+  METRICSADD(m, epochms, ms);
+}
+
+static void MetricsAge(struct metrics *m, const struct rtcm3age *a)
+{
+  int i;
+
+  if(!m)
+    return;
+  pthread_mutex_lock(&m->agelock);
+  for(i = 0; i < a->types; ++i)
+  {
+    m->age[i].type = a->t[i].type;
+    m->age[i].count = a->t[i].count;
+    m->age[i].sum = a->t[i].sum;
+    Rtcm3AgePercentiles(&a->t[i], metricsquantiles, m->age[i].quantile,
+    METRICSQUANTILES);
+  }
+  m->agetypes = a->types;
+  pthread_mutex_unlock(&m->agelock);
+}
+
+#define METRICSGET(m, field) \
+  atomic_load_explicit(&(m)->field, memory_order_relaxed)
+
+static void MetricsLabel(FILE *f, const struct metrics *m)
+{
+  const char *c;
+
+  fputs("{mountpoint=\"", f);
+  for(c = m->mountpoint; *c; ++c)
+  {
+    if(*c == '"' || *c == '\\')
+      fputc('\\', f);
+    if(*c == '\n')
+      fputs("\\n", f);
+    else
+      fputc(*c, f);
+  }
+  fputc('"', f);
+}
+
+static void MetricsCounter(FILE *f, struct metrics *list, const char *name,
+const char *help, size_t offset)
+{
+  struct metrics *m;
+
+  fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+  for(m = list; m; m = m->next)
+  {
+    fputs(name, f);
+    MetricsLabel(f, m);
+    fprintf(f, "} %lu\n", atomic_load_explicit(
+    (atomic_ulong *)((char *)m + offset), memory_order_relaxed));
+  }
+}
+
+static void MetricsPrint(FILE *f, struct metrics *list)
+{
+  long long now = MetricsTime();
+  struct metrics *m;
+  int i;
+
+  MetricsCounter(f, list, "ntrip_received_bytes_total",
+  "Bytes received from the caster.", offsetof(struct metrics, bytes));
+  fputs("# HELP ntrip_recv_size_bytes Size of the received blocks.\n"
+  "# TYPE ntrip_recv_size_bytes histogram\n", f);
+  for(m = list; m; m = m->next)
+  {
+    unsigned long count = 0;
+    for(i = 0; i <= METRICSSIZES; ++i)
+    {
+      count += METRICSGET(m, recvsize[i]);
+      fputs("ntrip_recv_size_bytes_bucket", f);
+      MetricsLabel(f, m);
+      if(i < METRICSSIZES)
+        fprintf(f, ",le=\"%lu\"} %lu\n", metricssizes[i], count);
+      else
+        fprintf(f, ",le=\"+Inf\"} %lu\n", count);
+    }
+    fputs("ntrip_recv_size_bytes_sum", f);
+    MetricsLabel(f, m);
+    fprintf(f, "} %lu\n", METRICSGET(m, bytes));
+    fputs("ntrip_recv_size_bytes_count", f);
+    MetricsLabel(f, m);
+    fprintf(f, "} %lu\n", count);
+  }
+  MetricsCounter(f, list, "ntrip_reconnects_total",
+  "Connections lost or failed.", offsetof(struct metrics, reconnects));
+  fputs("# HELP ntrip_handshake_seconds Time from connecting until the "
+  "response header.\n# TYPE ntrip_handshake_seconds histogram\n", f);
+  for(m = list; m; m = m->next)
+  {
+    unsigned long count = 0;
+    for(i = 0; i <= METRICSHANDSHAKES; ++i)
+    {
+      count += METRICSGET(m, handshake[i]);
+      fputs("ntrip_handshake_seconds_bucket", f);
+      MetricsLabel(f, m);
+      if(i < METRICSHANDSHAKES)
+        fprintf(f, ",le=\"%g\"} %lu\n", metricshandshakes[i], count);
+      else
+        fprintf(f, ",le=\"+Inf\"} %lu\n", count);
+    }
+    fputs("ntrip_handshake_seconds_sum", f);
+    MetricsLabel(f, m);
+    fprintf(f, "} %.6f\n", METRICSGET(m, handshakeus)/1000000.0);
+    fputs("ntrip_handshake_seconds_count", f);
+    MetricsLabel(f, m);
+    fprintf(f, "} %lu\n", count);
+  }
+  fputs("# HELP ntrip_data_age_seconds Time since the last received data.\n"
+  "# TYPE ntrip_data_age_seconds gauge\n", f);
+  for(m = list; m; m = m->next)
+  {
+    long long last = METRICSGET(m, lastdata);
+    fputs("ntrip_data_age_seconds", f);
+    MetricsLabel(f, m);
+    if(last)
+      fprintf(f, "} %.3f\n", (now-last)/1000.0);
+    else
+      fputs("} +Inf\n", f);
+  }
+  MetricsCounter(f, list, "ntrip_chunk_errors_total",
+  "Errors in the chunked transfer encoding.",
+  offsetof(struct metrics, chunkerrors));
+  fputs("# HELP ntrip_serial_backlog_bytes Data waiting in the serial "
+  "output queue.\n# TYPE ntrip_serial_backlog_bytes gauge\n", f);
+  for(m = list; m; m = m->next)
+  {
+    fputs("ntrip_serial_backlog_bytes", f);
+    MetricsLabel(f, m);
+    fprintf(f, "} %lu\n", METRICSGET(m, serialbacklog));
+  }
+  MetricsCounter(f, list, "ntrip_nmea_forwarded_total",
+  "NMEA sentences forwarded to the caster.", offsetof(struct metrics, nmea));
+  MetricsCounter(f, list, "ntrip_nmea_checksum_errors_total",
+  "NMEA sentences dropped for a wrong checksum.",
+  offsetof(struct metrics, nmeaerrors));
+  fputs("# HELP ntrip_epoch_completion_seconds Time from the epoch until "
+  "all its messages arrived.\n# TYPE ntrip_epoch_completion_seconds "
+  "histogram\n", f);
+  for(m = list; m; m = m->next)
+  {
+    unsigned long count = 0;
+    for(i = 0; i <= METRICSEPOCHS; ++i)
+    {
+      count += METRICSGET(m, epoch[i]);
+      fputs("ntrip_epoch_completion_seconds_bucket", f);
+      MetricsLabel(f, m);
+      if(i < METRICSEPOCHS)
+        fprintf(f, ",le=\"%g\"} %lu\n", metricsepochs[i], count);
+      else
+        fprintf(f, ",le=\"+Inf\"} %lu\n", count);
+    }
+    fputs("ntrip_epoch_completion_seconds_sum", f);
+    MetricsLabel(f, m);
+    fprintf(f, "} %.3f\n", METRICSGET(m, epochms)/1000.0);
+    fputs("ntrip_epoch_completion_seconds_count", f);
+    MetricsLabel(f, m);
+    fprintf(f, "} %lu\n", count);
+  }
+  MetricsCounter(f, list, "ntrip_epochs_incomplete_total",
+  "Epochs written without their last message.",
+  offsetof(struct metrics, epochsincomplete));
+  fputs("# HELP ntrip_correction_age_seconds Age of the observation "
+  "messages at arrival.\n# TYPE ntrip_correction_age_seconds summary\n", f);
+  for(m = list; m; m = m->next)
+  {
+    pthread_mutex_lock(&m->agelock);
+    for(i = 0; i < m->agetypes; ++i)
+    {
+      int j;
+      for(j = 0; j < METRICSQUANTILES; ++j)
+      {
+        fputs("ntrip_correction_age_seconds", f);
+        MetricsLabel(f, m);
+        fprintf(f, ",type=\"%d\",quantile=\"%g\"} %.3f\n", m->age[i].type,
+        metricsquantiles[j], m->age[i].quantile[j]/1000.0);
+      }
+      fputs("ntrip_correction_age_seconds_sum", f);
+      MetricsLabel(f, m);
+      fprintf(f, ",type=\"%d\"} %.3f\n", m->age[i].type, m->age[i].sum/1000.0);
+      fputs("ntrip_correction_age_seconds_count", f);
+      MetricsLabel(f, m);
+      fprintf(f, ",type=\"%d\"} %lu\n", m->age[i].type, m->age[i].count);
+    }
+    pthread_mutex_unlock(&m->agelock);
+  }
+}
+
+/* answers one request, slow or silent clients are given up after a
+   second, so they cannot block the endpoint */
+static void MetricsAnswer(struct metricsserver *s, int fd)
+{
+  char req[METRICSREQUEST];
+  struct timeval tv = {1, 0};
+  int len = 0, n;
+  FILE *f;
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  while(len < (int)sizeof(req)-1 && (n = recv(fd, req+len,
+  sizeof(req)-1-len, 0)) > 0)
+  {
+    req[len += n] = 0;
+    if(strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+      break;
+  }
+  req[len] = 0;
+  if(!(f = fdopen(fd, "w")))
+  {
+    close(fd);
+    return;
+  }
+  if(!strncmp(req, "GET /metrics ", 13) || !strncmp(req, "GET / ", 6))
+  {
+    fputs("HTTP/1.0 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4\r\n"
+    "Connection: close\r\n\r\n", f);
+    MetricsPrint(f, s->list);
+  }
+  else
+    fputs("HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n", f);
+  fclose(f);
+}
+
+static void *MetricsThread(void *data)
+{
+  struct metricsserver *s = data;
+
+  for(;;)
+  {
+    struct pollfd p[2] = {{s->wake[0], POLLIN, 0}, {s->sock, POLLIN, 0}};
+    int fd;
+
+    if(poll(p, 2, -1) < 0 && errno != EINTR)
+      break;
+    if(p[0].revents)
+      break;
+    if((p[1].revents & POLLIN) && (fd = accept(s->sock, 0, 0)) >= 0)
+      MetricsAnswer(s, fd);
+  }
+  return 0;
+}
+
+/* starts the endpoint for the streams in list, which must not change
+   afterwards, returns an error message or 0 */
+static const char *MetricsStart(struct metricsserver *s, const char *address,
+struct metrics *list)
+{
+  const char *e;
+
+  memset(s, 0, sizeof(*s));
+  s->list = list;
+  s->address = address;
+  if((e = FanoutSocket(address, &s->sock)))
+    return e;
+  if(pipe(s->wake))
+  {
+    close(s->sock);
+    return "could not create pipe";
+  }
+  if(pthread_create(&s->thread, 0, MetricsThread, s))
+  {
+    close(s->sock);
+    close(s->wake[0]);
+    close(s->wake[1]);
+    return "could not start metrics thread";
+  }
+  return 0;
+}
+
+static void MetricsStop(struct metricsserver *s)
+{
+  if(write(s->wake[1], "", 1) < 0)
+    pthread_cancel(s->thread);
+  pthread_join(s->thread, 0);
+  close(s->sock);
+  if(*s->address == '/')
+    unlink(s->address);
+  close(s->wake[0]);
+  close(s->wake[1]);
+}
+#else
+/* the counters are no-ops without the endpoint */
+struct metrics;
+#define MetricsRecv(m, size)
+#define MetricsReconnect(m)
+#define MetricsHandshake(m, ms)
+#define MetricsChunkError(m)
+#define MetricsBacklog(m, size)
+#define MetricsNmea(m)
+#define MetricsNmeaError(m)
+#define MetricsEpoch(m, e)
+#define MetricsAge(m, a)
+#endif /* HAVE_FANOUT */
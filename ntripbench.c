@@ -0,0 +1,1033 @@
+/*
+  End-to-end benchmark of the NTRIP client for POSIX with a mock caster.
+  $Id$
+  Copyright (C) 2026 by the ntripclient contributors
+  <https://github.com/nunojpg/ntripclient>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+  or read http://www.gnu.org/licenses/gpl.txt
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define RTCM3FRAMESONLY
+#include "rtcm3.c"
+
+/* The mock caster runs in a thread of this program, the client is started
+   as child process and writes to a pipe read by this program. Each frame
+   carries its send time and the step of the run in the 10 bytes after
+   the multiple message bit of the MSM header, which is left alone, as
+   the client holds the frames of an epoch until it is complete. A run first sends at a low rate to measure the
+   latency. Then the TCP based modes send as fast as possible, while the
+   UDP based modes double their rate until more than 1% is lost.
+
+   With faults given, each trial starts a new client, lets the data flow
+   and then the caster injects one fault. The time from the fault until
+   the first frame sent after it comes out of the client is the recovery
+   time. */
+#define BENCHMSG       512        /* message bytes of generated frames */
+#define BENCHSTAMP     (3+7)      /* frame offset of the time stamp */
+#define BENCHMINFRAME  (3+17+3)   /* smallest frame carrying a stamp */
+#define BENCHSTEPS     12
+#define BENCHSTEPTIME  0.5        /* seconds of each UDP rate step */
+#define BENCHDRAIN     0.3        /* seconds waited for late data */
+#define BENCHBATCH     65536      /* bytes written at once */
+#define BENCHSESSION   777
+#define BENCHSTALL     10         /* seconds without data ending a run */
+#define BENCHSLICE     0.02       /* seconds sent between fault checks */
+#define BENCHSETTLE    0.5        /* seconds of data before a fault */
+#define BENCHPAUSE     1.0        /* seconds of a delay or a loss */
+#define BENCHDOWN      1.0        /* seconds a restarted caster is down */
+#define BENCHDRIP      20000000   /* ns between the bytes of a slow reply */
+
+enum BenchMode { NTRIP1, HTTP, CHUNKED, RTSP, UDP, MODES };
+static const char *benchmodes[MODES] = {"ntrip1", "http", "chunked",
+"rtsp", "udp"};
+static const char *benchflags[MODES] = {"n", "h", "h", "r", "u"};
+
+/* reset: the connection is reset (RTP close packet for UDP)
+   restart: the caster closes all sockets and is down for BENCHDOWN
+   stall: the connection stays open, but no more data is sent (half-open)
+   delay: no data is sent for BENCHPAUSE
+   drop: the datagrams of BENCHPAUSE are lost, UDP based modes only
+   drip: reset, the next reply comes byte by byte, TCP based modes only */
+enum BenchFault { RESET, RESTART, STALL, DELAY, DROP, DRIP, FAULTS };
+static const char *benchfaults[FAULTS] = {"reset", "restart", "stall",
+"delay", "drop", "drip"};
+
+struct bench
+{
+  const char     *client;
+  double          rate;           /* bytes/s of the latency step */
+  double          duration;       /* seconds of the latency and TCP steps */
+  unsigned char  *frames;         /* frames replayed one after the other */
+  int            *framepos;
+  int             numframes;
+  enum BenchMode  mode;
+  int             tcp;            /* caster sockets */
+  int             udp;
+  struct sockaddr_in tcpaddr;     /* kept for a restart */
+  struct sockaddr_in udpaddr;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+  int             go;             /* highest step the caster may send */
+  int             finished;       /* last step sent completely */
+  int             quit;
+  double          nominal[BENCHSTEPS];    /* bytes/s, 0 unlimited */
+  unsigned long   sent[BENCHSTEPS];       /* stamped frames */
+  unsigned long   received[BENCHSTEPS];
+  unsigned long   bytes[BENCHSTEPS];      /* received */
+  double          first[BENCHSTEPS];
+  double          last[BENCHSTEPS];
+  double         *latency;                /* ms, latency step only */
+  int             numlatency;
+  int             maxlatency;
+  enum BenchFault fault;
+  int             inject;         /* the fault is due */
+  double          faulttime;      /* when the caster injected it */
+  int             drop;           /* datagrams are lost */
+  int             trials;
+  double          limit;          /* seconds waited for the recovery */
+};
+
+static double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static int compare(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* generated frames of MSM7 size */
+static int makeframes(struct bench *b, int num)
+{
+  int i, j;
+
+  if(!(b->frames = malloc(num*(BENCHMSG+6)))
+  || !(b->framepos = malloc((num+1)*sizeof(int))))
+    return 0;
+  for(i = 0; i < num; ++i)
+  {
+    unsigned char *f = b->frames+i*(BENCHMSG+6);
+    b->framepos[i] = i*(BENCHMSG+6);
+    f[0] = RTCM3PREAMBLE;
+    f[1] = BENCHMSG >> 8;
+    f[2] = BENCHMSG & 0xFF;
+    f[3] = 1077 >> 4;
+    f[4] = (1077 & 0xF) << 4;
+    for(j = 5; j < BENCHMSG+3; ++j)
+      f[j] = rand();
+    /* each frame is an epoch of its own */
+    f[3+54/8] &= ~(0x80 >> 54%8);
+  }
+  b->framepos[num] = num*(BENCHMSG+6);
+  b->numframes = num;
+  return 1;
+}
+
+/* recorded frames from a file */
+static int loadframes(struct bench *b, const char *name)
+{
+  struct rtcm3 r;
+  const unsigned char *frame;
+  char *data;
+  const char *in;
+  long size;
+  int left, n, max = 0;
+  FILE *f;
+
+  if(!(f = fopen(name, "rb")))
+    return 0;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  rewind(f);
+  if(size <= 0 || !(data = malloc(size)) || fread(data, size, 1, f) != 1
+  || !(b->frames = malloc(size)) || !(b->framepos = malloc((size/6+1)*sizeof(int))))
+  {
+    fclose(f);
+    return 0;
+  }
+  fclose(f);
+  memset(&r, 0, sizeof(r));
+  Rtcm3Reset(&r);
+  in = data;
+  left = size;
+  while((n = Rtcm3Next(&r, &in, &left, &frame)))
+  {
+    b->framepos[b->numframes++] = max;
+    memcpy(b->frames+max, frame, n);
+    max += n;
+  }
+  b->framepos[b->numframes] = max;
+  free(data);
+  return b->numframes > 0;
+}
+
+/* the send time in ns of a frame of at least BENCHMINFRAME bytes */
+static unsigned long long framestamp(const unsigned char *frame)
+{
+  unsigned long long s = 0;
+  int j;
+
+  for(j = 0; j < 8; ++j)
+    s = (s << 8) | frame[BENCHSTAMP+j];
+  return s;
+}
+
+/* copies frame i with time stamp, step and new checksum */
+static int stampframe(struct bench *b, int i, int step, unsigned char *out)
+{
+  int size = b->framepos[i+1]-b->framepos[i];
+  unsigned long long t;
+  unsigned long crc;
+  int j;
+
+  memcpy(out, b->frames+b->framepos[i], size);
+  if(size < BENCHMINFRAME)
+    return size;
+  t = (unsigned long long)(now()*1e9);
+  for(j = 0; j < 8; ++j)
+    out[BENCHSTAMP+j] = t >> (56-8*j);
+  out[BENCHSTAMP+8] = step >> 8;
+  out[BENCHSTAMP+9] = step;
+  crc = Rtcm3CRC(out, size-3);
+  out[size-3] = crc >> 16;
+  out[size-2] = crc >> 8;
+  out[size-1] = crc;
+  return size;
+}
+
+static int sendall(int fd, const void *buf, int size)
+{
+  const char *p = buf;
+  while(size > 0)
+  {
+    int i = send(fd, p, size, MSG_NOSIGNAL);
+    if(i <= 0)
+      return -1;
+    p += i;
+    size -= i;
+  }
+  return 0;
+}
+
+/* sends a reply, with drip one byte after the other */
+static int sendreply(struct bench *b, int fd, const char *buf, int size,
+int drip)
+{
+  struct timespec ts = {0, BENCHDRIP};
+
+  if(!drip)
+    return sendall(fd, buf, size);
+  for(; size > 0 && !b->quit; ++buf, --size)
+  {
+    nanosleep(&ts, 0);
+    if(sendall(fd, buf, 1) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* reads a request up to the empty line */
+static int readrequest(int fd, char *buf, int size)
+{
+  int len = 0, i;
+
+  while(len < size-1 && (i = recv(fd, buf+len, size-1-len, 0)) > 0)
+  {
+    buf[len += i] = 0;
+    if(strstr(buf, "\r\n\r\n"))
+      return len;
+  }
+  return -1;
+}
+
+static void rtpheader(unsigned char *p, int seq)
+{
+  p[0] = 2 << 6;
+  p[1] = 96;
+  p[2] = seq >> 8;
+  p[3] = seq;
+  memset(p+4, 0, 4);
+  p[8] = BENCHSESSION >> 24;
+  p[9] = BENCHSESSION >> 16;
+  p[10] = BENCHSESSION >> 8;
+  p[11] = BENCHSESSION & 0xFF;
+}
+
+/* sends one step for duration seconds, TCP data goes to fd, UDP data to
+   peer, returns -1 when the TCP connection failed */
+static int sendstep(struct bench *b, int fd, struct sockaddr_in *peer,
+int step, double duration, int *frame, int *seq)
+{
+  static unsigned char buf[BENCHBATCH+RTCM3MAXFRAME+32];
+  double rate = b->nominal[step], start = now(), t, sentbytes = 0;
+
+  while((t = now()-start) < duration && !b->quit)
+  {
+    double due = rate ? t*rate - sentbytes : BENCHBATCH;
+    int len = 0, ofs = b->mode == CHUNKED ? 8 : 0;
+
+    if(due <= 0)
+    {
+      struct timespec ts = {0, 500000};
+      nanosleep(&ts, 0);
+      continue;
+    }
+    if(b->mode == RTSP || b->mode == UDP)
+    {
+      /* one frame in each datagram */
+      for(; due > 0 && len < BENCHBATCH; *frame = (*frame+1) % b->numframes)
+      {
+        int n = stampframe(b, *frame, step, buf+12);
+        rtpheader(buf, (*seq)++);
+        if(!b->drop && sendto(b->udp, buf, n+12, 0, (struct sockaddr *)peer,
+        sizeof(*peer)) == n+12 && n >= BENCHMINFRAME)
+          ++b->sent[step];
+        due -= n;
+        len += n;
+      }
+    }
+    else
+    {
+      for(; due > 0 && len < BENCHBATCH; *frame = (*frame+1) % b->numframes)
+      {
+        int n = stampframe(b, *frame, step, buf+ofs+len);
+        if(n >= BENCHMINFRAME)
+          ++b->sent[step];
+        due -= n;
+        len += n;
+      }
+      if(b->mode == CHUNKED)
+      {
+        /* fixed size chunk header, then the chunk end */
+        char head[9];
+        snprintf(head, sizeof(head), "%06x\r\n", len);
+        memcpy(buf, head, 8);
+        memcpy(buf+8+len, "\r\n", 2);
+        if(sendall(fd, buf, len+10) < 0)
+          return -1;
+      }
+      else if(sendall(fd, buf, len) < 0)
+        return -1;
+    }
+    sentbytes += len;
+  }
+  return 0;
+}
+
+/* waits for the request of the client and answers it, drip sends the
+   replies byte by byte, returns 1 when the data may be sent */
+static int connectclient(struct bench *b, int *fd, struct sockaddr_in *peer,
+int drip)
+{
+  struct sockaddr_in from;
+  socklen_t flen = sizeof(from);
+  char req[2000];
+  const char *reply = 0;
+  int n;
+
+  switch(b->mode)
+  {
+  case NTRIP1:
+    reply = "ICY 200 OK\r\n\r\n";
+    break;
+  case HTTP:
+    reply = "HTTP/1.1 200 OK\r\nContent-Type: gnss/data\r\n\r\n";
+    break;
+  case CHUNKED:
+    reply = "HTTP/1.1 200 OK\r\nContent-Type: gnss/data\r\n"
+    "Transfer-Encoding: chunked\r\n\r\n";
+    break;
+  case UDP:
+    /* keep alive packets have no request */
+    if(recvfrom(b->udp, req, sizeof(req), 0, (struct sockaddr *)&from,
+    &flen) <= 12)
+      return 0;
+    *peer = from;
+    n = snprintf(req+12, sizeof(req)-12, "HTTP/1.1 200 OK\r\n"
+    "Content-Type: gnss/data\r\nSession: %d\r\n\r\n", BENCHSESSION);
+    rtpheader((unsigned char *)req, 0);
+    sendto(b->udp, req, n+12, 0, (struct sockaddr *)peer, flen);
+    return 1;
+  case RTSP:
+    if((*fd = accept(b->tcp, 0, 0)) >= 0 && readrequest(*fd, req, sizeof(req)) > 0)
+    {
+      const char *p = strstr(req, "client_port=");
+      memset(peer, 0, sizeof(*peer));
+      peer->sin_family = AF_INET;
+      peer->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      peer->sin_port = htons(p ? atoi(p+12) : 0);
+      n = snprintf(req, sizeof(req), "RTSP/1.0 200 OK\r\nCSeq: 1\r\n"
+      "Session: %d\r\nTransport: RTP/GNSS;unicast;client_port=%d;"
+      "server_port=%d\r\n\r\n", BENCHSESSION, ntohs(peer->sin_port),
+      ntohs(b->udpaddr.sin_port));
+      if(sendreply(b, *fd, req, n, drip) < 0
+      || readrequest(*fd, req, sizeof(req)) < 0)
+        return 0;
+      n = snprintf(req, sizeof(req), "RTSP/1.0 200 OK\r\nCSeq: 2\r\n"
+      "Session: %d\r\n\r\n", BENCHSESSION);
+      return !sendreply(b, *fd, req, n, drip);
+    }
+    return 0;
+  default:
+    return 0;
+  }
+  return (*fd = accept(b->tcp, 0, 0)) >= 0
+  && readrequest(*fd, req, sizeof(req)) >= 0
+  && !sendreply(b, *fd, reply, strlen(reply), drip);
+}
+
+static void *caster(void *data)
+{
+  struct bench *b = data;
+  struct sockaddr_in peer;
+  int fd = -1, step, frame = 0, seq = 1, connected;
+
+  memset(&peer, 0, sizeof(peer));
+  connected = connectclient(b, &fd, &peer, 0);
+  for(step = 0; step < BENCHSTEPS && connected; ++step)
+  {
+    pthread_mutex_lock(&b->mutex);
+    while(b->go < step && !b->quit)
+      pthread_cond_wait(&b->cond, &b->mutex);
+    pthread_mutex_unlock(&b->mutex);
+    if(b->quit)
+      break;
+    sendstep(b, fd, &peer, step, step && (b->mode == RTSP || b->mode == UDP)
+    ? BENCHSTEPTIME : b->duration, &frame, &seq);
+    pthread_mutex_lock(&b->mutex);
+    b->finished = step;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->mutex);
+  }
+  /* the connection stays open until the client is stopped */
+  pthread_mutex_lock(&b->mutex);
+  b->finished = BENCHSTEPS;
+  while(!b->quit)
+    pthread_cond_wait(&b->cond, &b->mutex);
+  pthread_mutex_unlock(&b->mutex);
+  if(fd >= 0)
+    close(fd);
+  return 0;
+}
+
+/* opens the caster sockets at the addresses in b, which then hold the
+   ports, so a restart gets the same ones */
+static int listensockets(struct bench *b)
+{
+  socklen_t len = sizeof(b->tcpaddr);
+  int on = 1;
+
+  b->tcp = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  b->udp = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+  if(b->tcp < 0 || b->udp < 0
+  || setsockopt(b->tcp, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+  || bind(b->tcp, (struct sockaddr *)&b->tcpaddr, sizeof(b->tcpaddr))
+  || listen(b->tcp, 1)
+  || bind(b->udp, (struct sockaddr *)&b->udpaddr, sizeof(b->udpaddr)))
+    return 0;
+  getsockname(b->tcp, (struct sockaddr *)&b->tcpaddr, &len);
+  len = sizeof(b->udpaddr);
+  getsockname(b->udp, (struct sockaddr *)&b->udpaddr, &len);
+  return 1;
+}
+
+/* injects the fault into the connection of the caster, returns 0 when the
+   connection is gone */
+static int injectfault(struct bench *b, int *fd, struct sockaddr_in *peer,
+int *seq, double *resume)
+{
+  struct linger l = {1, 0};
+  struct timespec ts = {0, 10000000};
+  unsigned char close98[12];
+  double up;
+
+  switch(b->fault)
+  {
+  case RESET: case DRIP:
+    if(b->mode == UDP)
+    {
+      rtpheader(close98, (*seq)++);
+      close98[1] = 98;
+      sendto(b->udp, close98, sizeof(close98), 0, (struct sockaddr *)peer,
+      sizeof(*peer));
+    }
+    else
+      setsockopt(*fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+    break;
+  case RESTART:
+    if(*fd >= 0)
+      close(*fd);
+    *fd = -1;
+    close(b->tcp);
+    close(b->udp);
+    for(up = now()+BENCHDOWN; now() < up && !b->quit;)
+      nanosleep(&ts, 0);
+    if(!listensockets(b))
+      perror("mock caster restart");
+    return 0;
+  case STALL:
+    return 1;
+  case DELAY: case DROP:
+    *resume = now()+BENCHPAUSE;
+    b->drop = b->fault == DROP;
+    return 1;
+  default:
+    break;
+  }
+  if(*fd >= 0)
+    close(*fd);
+  *fd = -1;
+  return 0;
+}
+
+/* serves any number of connections at the rate of the latency step and
+   injects the fault when it is due */
+static void *faultcaster(void *data)
+{
+  struct bench *b = data;
+  struct sockaddr_in peer;
+  struct timespec ts = {0, 1000000};
+  int fd = -1, frame = 0, seq = 1, live = 0, stalled = 0, drip = 0, due;
+  double resume = 0;
+
+  memset(&peer, 0, sizeof(peer));
+  while(!b->quit)
+  {
+    struct pollfd p = {b->mode == UDP ? b->udp : b->tcp, POLLIN, 0};
+
+    /* a new connection replaces the old one */
+    if(poll(&p, 1, live && !stalled ? 0 : 20) > 0)
+    {
+      int old = fd;
+      fd = -1;
+      if(connectclient(b, &fd, &peer, drip))
+      {
+        if(old >= 0)
+          close(old);
+        live = 1;
+        stalled = drip = 0;
+      }
+      else
+      {
+        if(fd >= 0)
+          close(fd);
+        fd = old;
+      }
+      continue;
+    }
+    if(!live || stalled)
+      continue;
+    pthread_mutex_lock(&b->mutex);
+    if((due = b->inject && !b->faulttime))
+      b->faulttime = now();
+    pthread_mutex_unlock(&b->mutex);
+    if(due)
+    {
+      live = injectfault(b, &fd, &peer, &seq, &resume);
+      stalled = b->fault == STALL;
+      drip = b->fault == DRIP;
+    }
+    else if(resume && now() < resume && !b->drop)
+      nanosleep(&ts, 0);
+    else
+    {
+      if(resume && now() >= resume)
+      {
+        resume = 0;
+        b->drop = 0;
+      }
+      if(sendstep(b, fd, &peer, 0, BENCHSLICE, &frame, &seq) < 0)
+      {
+        close(fd);
+        fd = -1;
+        live = 0;
+      }
+    }
+  }
+  if(fd >= 0)
+    close(fd);
+  return 0;
+}
+
+static void receive(struct bench *b, const unsigned char *frame, int size,
+double t)
+{
+  unsigned long long s;
+  int step;
+
+  if(size < BENCHMINFRAME)
+    return;
+  s = framestamp(frame);
+  step = (frame[BENCHSTAMP+8] << 8) | frame[BENCHSTAMP+9];
+  if(step >= BENCHSTEPS)
+    return;
+  if(!b->received[step]++)
+    b->first[step] = t;
+  b->last[step] = t;
+  b->bytes[step] += size;
+  if(!step)
+  {
+    if(b->numlatency == b->maxlatency)
+    {
+      double *l = realloc(b->latency, (b->maxlatency = b->maxlatency*2+1024)
+      *sizeof(double));
+      if(!l)
+        return;
+      b->latency = l;
+    }
+    b->latency[b->numlatency++] = (t - s*1e-9)*1000.0;
+  }
+}
+
+/* decides after each step whether the next one is sent, returns 0 at
+   the end of the run */
+static int nextstep(struct bench *b, int step)
+{
+  int udp = b->mode == RTSP || b->mode == UDP;
+
+  if(!step)
+  {
+    b->nominal[1] = udp ? 1e6 : 0;
+    return 1;
+  }
+  if(!udp || step+1 == BENCHSTEPS || b->received[step] < 0.99*b->sent[step])
+    return 0;
+  /* stop when the caster cannot send faster */
+  if(b->sent[step] < 0.9*b->nominal[step]*BENCHSTEPTIME
+  / ((double)b->framepos[b->numframes]/b->numframes))
+    return 0;
+  b->nominal[step+1] = b->nominal[step]*2;
+  return 1;
+}
+
+/* opens the caster sockets, starts the caster thread and the client,
+   returns the pipe with the output of the client or -1 */
+static int startrun(struct bench *b, enum BenchMode mode,
+void *(*casterthread)(void *), pthread_t *thread, pid_t *pid)
+{
+  char port[20];
+  const char *argv[16];
+  int fds[2], argc = 0;
+
+  b->mode = mode;
+  b->quit = 0;
+  memset(&b->tcpaddr, 0, sizeof(b->tcpaddr));
+  b->tcpaddr.sin_family = AF_INET;
+  b->tcpaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  b->udpaddr = b->tcpaddr;
+  if(!listensockets(b))
+  {
+    perror("mock caster");
+    return -1;
+  }
+  snprintf(port, sizeof(port), "%d", ntohs(mode == UDP ? b->udpaddr.sin_port
+  : b->tcpaddr.sin_port));
+  if(pipe(fds) || pthread_create(thread, 0, casterthread, b))
+  {
+    perror("bench");
+    return -1;
+  }
+
+  argv[argc++] = b->client;
+  argv[argc++] = "-s";
+  argv[argc++] = "127.0.0.1";
+  argv[argc++] = "-r";
+  argv[argc++] = port;
+  argv[argc++] = "-m";
+  argv[argc++] = "BENCH";
+  argv[argc++] = "-M";
+  argv[argc++] = benchflags[mode];
+  argv[argc] = 0;
+  if(!(*pid = fork()))
+  {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(fds[1], 1);
+    dup2(null, 2);
+    close(fds[0]);
+    close(fds[1]);
+    execv(b->client, (char * const *)argv);
+    _exit(127);
+  }
+  close(fds[1]);
+  return fds[0];
+}
+
+/* stops the client and the caster */
+static void endrun(struct bench *b, int fd, pthread_t thread, pid_t pid,
+struct rusage *ru)
+{
+  int status;
+
+  kill(pid, SIGTERM);
+  wait4(pid, &status, 0, ru);
+  pthread_mutex_lock(&b->mutex);
+  b->quit = 1;
+  pthread_cond_broadcast(&b->cond);
+  pthread_mutex_unlock(&b->mutex);
+  pthread_join(thread, 0);
+  close(fd);
+  close(b->tcp);
+  close(b->udp);
+}
+
+static int run(struct bench *b, enum BenchMode mode)
+{
+  struct rtcm3 r;
+  struct rusage ru;
+  pthread_t thread;
+  int fd, step = 0, i, best = 0;
+  double drain = 0, cpu, mb = 0, maxrate = 0, lastdata = now();
+  pid_t pid;
+
+  memset(b->sent, 0, sizeof(b->sent));
+  memset(b->received, 0, sizeof(b->received));
+  memset(b->bytes, 0, sizeof(b->bytes));
+  memset(b->nominal, 0, sizeof(b->nominal));
+  b->numlatency = 0;
+  b->go = 0;
+  b->finished = -1;
+  b->nominal[0] = b->rate;
+  if((fd = startrun(b, mode, caster, &thread, &pid)) < 0)
+    return 0;
+  memset(&r, 0, sizeof(r));
+  Rtcm3Reset(&r);
+
+  for(;;)
+  {
+    static char buf[262144];
+    struct pollfd p = {fd, POLLIN, 0};
+    int n, finished;
+
+    if(poll(&p, 1, 20) > 0)
+    {
+      const unsigned char *frame;
+      const char *in = buf;
+      double t = now();
+      if((n = read(fd, buf, sizeof(buf))) <= 0)
+        break;
+      lastdata = t;
+      mb += n/1e6;
+      while((i = Rtcm3Next(&r, &in, &n, &frame)))
+        receive(b, frame, i, t);
+    }
+    if(now() > lastdata + BENCHSTALL)
+    {
+      fprintf(stderr, "%s: no data for %d seconds\n", benchmodes[mode],
+      BENCHSTALL);
+      break;
+    }
+    pthread_mutex_lock(&b->mutex);
+    finished = b->finished;
+    pthread_mutex_unlock(&b->mutex);
+    if(finished >= step)
+    {
+      if(!drain)
+        drain = now() + BENCHDRAIN;
+      else if(now() > drain)
+      {
+        drain = 0;
+        if(finished == BENCHSTEPS || !nextstep(b, step))
+          break;
+        pthread_mutex_lock(&b->mutex);
+        b->go = ++step;
+        pthread_cond_broadcast(&b->cond);
+        pthread_mutex_unlock(&b->mutex);
+      }
+    }
+  }
+
+  endrun(b, fd, thread, pid, &ru);
+
+  cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1e-6
+  + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1e-6;
+  for(i = 1; i <= step; ++i)
+  {
+    /* the rate of the last complete step counts */
+    if(b->received[i] && b->received[i] >= 0.99*b->sent[i]
+    && b->last[i] > b->first[i])
+    {
+      best = i;
+      maxrate = b->bytes[i]/(b->last[i]-b->first[i])*1e-6;
+    }
+  }
+  printf("%-8s", benchmodes[mode]);
+  if(b->numlatency)
+  {
+    double *l = b->latency;
+    int num = b->numlatency;
+    qsort(l, num, sizeof(*l), compare);
+    printf(" %7.3f %7.3f %7.3f %7.3f", l[num/2], l[num*9/10], l[num*99/100],
+    l[num-1]);
+  }
+  else
+    printf(" %7s %7s %7s %7s", "-", "-", "-", "-");
+  printf("  %9.1f%s %8.1f  %5lu/%lu\n", maxrate, best ? " " : "?",
+  mb ? cpu*1000/mb : 0, b->received[0], b->sent[0]);
+  return 1;
+}
+
+/* starts a client and injects the fault once the data flows, returns the
+   ms from the fault until the first frame sent after it came out of the
+   client, -1 when it did not within the limit and -2 on errors */
+static double trial(struct bench *b, enum BenchMode mode,
+enum BenchFault fault)
+{
+  struct rtcm3 r;
+  struct rusage ru;
+  pthread_t thread;
+  double start = now(), settle = 0, injected = 0, res = -1, t;
+  int fd, i;
+  pid_t pid;
+
+  b->fault = fault;
+  b->inject = 0;
+  b->faulttime = 0;
+  b->drop = 0;
+  b->nominal[0] = b->rate;
+  if((fd = startrun(b, mode, faultcaster, &thread, &pid)) < 0)
+    return -2;
+  memset(&r, 0, sizeof(r));
+  Rtcm3Reset(&r);
+
+  while(res < 0)
+  {
+    static char buf[262144];
+    struct pollfd p = {fd, POLLIN, 0};
+    int n;
+
+    if(poll(&p, 1, 20) > 0)
+    {
+      const unsigned char *frame;
+      const char *in = buf;
+      unsigned long long due;
+      if((n = read(fd, buf, sizeof(buf))) <= 0)
+        break;
+      t = now();
+      if(!settle)
+        settle = t + BENCHSETTLE;
+      pthread_mutex_lock(&b->mutex);
+      injected = b->faulttime;
+      pthread_mutex_unlock(&b->mutex);
+      due = (unsigned long long)(injected*1e9);
+      while(res < 0 && (i = Rtcm3Next(&r, &in, &n, &frame)))
+      {
+        if(injected && i >= BENCHMINFRAME && framestamp(frame) >= due)
+          res = (t-injected)*1000.0;
+      }
+    }
+    t = now();
+    pthread_mutex_lock(&b->mutex);
+    if(settle && t > settle)
+      b->inject = 1;
+    injected = b->faulttime;
+    pthread_mutex_unlock(&b->mutex);
+    if(injected ? t > injected + b->limit : t > start + BENCHSTALL)
+      break;
+  }
+
+  endrun(b, fd, thread, pid, &ru);
+  if(!injected)
+  {
+    fprintf(stderr, "%s: no data for %d seconds\n", benchmodes[mode],
+    BENCHSTALL);
+    return -2;
+  }
+  return res;
+}
+
+/* runs the trials of a fault and prints the recovery times */
+static int recovery(struct bench *b, enum BenchMode mode,
+enum BenchFault fault)
+{
+  double *l, over = b->limit*1000.0;
+  char limit[20];
+  int i, ok = 0, num = b->trials;
+
+  printf("%-8s %-8s", benchmodes[mode], benchfaults[fault]);
+  if((fault == DROP && mode != RTSP && mode != UDP)
+  || (fault == DRIP && mode == UDP))
+  {
+    printf("  %9s\n", "-");
+    return 1;
+  }
+  fflush(stdout);
+  if(!(l = malloc(num*sizeof(*l))))
+    return 0;
+  for(i = 0; i < num; ++i)
+  {
+    if((l[i] = trial(b, mode, fault)) < -1)
+    {
+      free(l);
+      return 0;
+    }
+    if(l[i] >= 0 && l[i] <= over)
+      ++ok;
+    else
+      l[i] = over+1; /* sorted behind the recovered ones */
+  }
+  qsort(l, num, sizeof(*l), compare);
+  snprintf(limit, sizeof(limit), ">%.0f", over);
+  printf("  %4d/%-4d", ok, num);
+  for(i = 0; i < 3; ++i)
+  {
+    double v = l[i == 0 ? num/2 : i == 1 ? num*9/10 : num-1];
+    if(v > over)
+      printf(" %8s", limit);
+    else
+      printf(" %8.1f", v);
+  }
+  printf("\n");
+  free(l);
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  struct bench b;
+  const char *file = 0;
+  char *faults = 0;
+  int i, c, f, modes = 0, sel[MODES], nfaults = 0, fsel[FAULTS];
+
+  memset(&b, 0, sizeof(b));
+  b.client = "./ntripclient";
+  b.rate = 100000;
+  b.duration = 2;
+  b.trials = 5;
+  b.limit = 10;
+  while((c = getopt(argc, argv, "c:f:r:t:x:n:w:")) != -1)
+  {
+    switch(c)
+    {
+    case 'c': b.client = optarg; break;
+    case 'f': file = optarg; break;
+    case 'r': b.rate = atof(optarg); break;
+    case 't': b.duration = atof(optarg); break;
+    case 'x': faults = optarg; break;
+    case 'n': b.trials = atoi(optarg); break;
+    case 'w': b.limit = atof(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-c client] [-f recorded.rtcm3] "
+      "[-r bytes/s] [-t seconds] [-x fault,...|all [-n trials] "
+      "[-w seconds]] [mode ...]\nmodes: ntrip1 http chunked rtsp udp\n"
+      "faults: reset restart stall delay drop drip\n", argv[0]);
+      return 1;
+    }
+  }
+  for(faults = faults ? strtok(faults, ",") : 0; faults;
+  faults = strtok(0, ","))
+  {
+    if(!strcmp(faults, "all"))
+    {
+      for(nfaults = 0; nfaults < FAULTS; ++nfaults)
+        fsel[nfaults] = nfaults;
+      continue;
+    }
+    for(f = 0; f < FAULTS && strcmp(faults, benchfaults[f]); ++f)
+      ;
+    if(f == FAULTS)
+    {
+      fprintf(stderr, "Fault %s unknown\n", faults);
+      return 1;
+    }
+    if(nfaults < FAULTS)
+      fsel[nfaults++] = f;
+  }
+  if(b.trials < 1 || b.limit <= 0)
+  {
+    fprintf(stderr, "Trials and limit must be positive\n");
+    return 1;
+  }
+  for(i = optind; i < argc; ++i)
+  {
+    for(c = 0; c < MODES && strcmp(argv[i], benchmodes[c]); ++c)
+      ;
+    if(c == MODES)
+    {
+      fprintf(stderr, "Mode %s unknown\n", argv[i]);
+      return 1;
+    }
+    sel[modes++] = c;
+  }
+  if(!modes)
+  {
+    for(c = 0; c < MODES; ++c)
+      sel[modes++] = c;
+  }
+  Rtcm3Init();
+  srand(1);
+  if(file ? !loadframes(&b, file) : !makeframes(&b, 1024))
+  {
+    fprintf(stderr, "Could not %s frames\n", file ? "load" : "create");
+    return 1;
+  }
+  pthread_mutex_init(&b.mutex, 0);
+  pthread_cond_init(&b.cond, 0);
+  signal(SIGPIPE, SIG_IGN);
+  if(nfaults)
+  {
+    printf("%d frames of %d bytes average at %.0f byte/s, %d trials, "
+    "limit %.0f s\n", b.numframes, b.framepos[b.numframes]/b.numframes,
+    b.rate, b.trials, b.limit);
+    printf("mode     fault    recovered  ms from fault to data\n"
+    "                               50%%      90%%      max\n");
+    for(i = 0; i < modes; ++i)
+    {
+      for(f = 0; f < nfaults; ++f)
+      {
+        if(!recovery(&b, sel[i], fsel[f]))
+          return 1;
+      }
+    }
+  }
+  else
+  {
+    printf("%d frames of %d bytes average, latency step at %.0f byte/s\n",
+    b.numframes, b.framepos[b.numframes]/b.numframes, b.rate);
+    printf("mode     latency in ms                     max rate  CPU     "
+    "frames\n         50%%     90%%     99%%     max      in MB/s   ms/MB   "
+    "received\n");
+    for(i = 0; i < modes; ++i)
+    {
+      if(!run(&b, sel[i]))
+        return 1;
+    }
+  }
+  free(b.latency);
+  free(b.frames);
+  free(b.framepos);
+  return 0;
+}
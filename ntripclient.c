@@ -19,6 +19,10 @@
   or read http://www.gnu.org/licenses/gpl.txt
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE /* splice() */
+#endif
+
 #include <ctype.h>
 #include <getopt.h>
 #include <stdio.h>
@@ -28,29 +32,64 @@
 #include <time.h>
 
 #include "serial.c"
+#include "rtcm3.c"
+#include "rtp.c"
+#include "fanout.c"
+#include "metrics.c"
+#include "sourcetable.c"
+#include "merge.c"
 
 #ifdef WINDOWSVERSION
-  #include <winsock.h>
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
   typedef SOCKET sockettype;
   typedef u_long in_addr_t;
-  typedef size_t socklen_t;
   void myperror(char *s)
   {
     fprintf(stderr, "%s: %d\n", s, WSAGetLastError());
   }
+  void printsocketerror(const char *s, int e)
+  {
+    fprintf(stderr, "%s: %d\n", s, e);
+  }
+  #define socketerror()         WSAGetLastError()
+  #define CONNECTPENDING(e)     ((e) == WSAEWOULDBLOCK)
+  #define WOULDBLOCK(e)         ((e) == WSAEWOULDBLOCK)
+  #ifndef ETIMEDOUT
+  #define ETIMEDOUT             WSAETIMEDOUT
+  #endif
 #else
   typedef int sockettype;
   #include <signal.h>
   #include <fcntl.h>
+  #include <poll.h>
+  #include <pthread.h>
+  #include <stdatomic.h>
   #include <unistd.h>
   #include <arpa/inet.h>
   #include <sys/socket.h>
   #include <netinet/in.h>
   #include <netdb.h>
+  #include <sys/uio.h>
 
   #define closesocket(sock)       close(sock)
   #define ALARMTIME   (2*60)
   #define myperror perror
+  #define socketerror()           errno
+  #define CONNECTPENDING(e)       ((e) == EINPROGRESS)
+  #define WOULDBLOCK(e)           ((e) == EAGAIN || (e) == EWOULDBLOCK \
+                                  || (e) == EINTR)
+  #define printsocketerror(s, e)  fprintf(stderr, "%s: %s\n", (s), strerror(e))
+  #define HAVE_HANDOVER
+  #define HAVE_MERGE
+
+  #ifdef __linux__
+    #include <sys/epoll.h>
+    #include <sys/stat.h>
+    #define HAVE_EPOLL
+    #define HAVE_SPLICE
+    #define HAVE_RECVMMSG
+  #endif
 #endif
 
 #ifndef COMPILEDATE
@@ -62,6 +101,9 @@
 #define TIME_RESOLUTION 125
 
 #define MAXDATASIZE 1000 /* max number of bytes we can get at once */
+#define SPLICESIZE 65536 /* max number of bytes moved at once by splice() */
+#define MAXLISTEN  4     /* local listening addresses */
+#define MAXSTANDBY 4     /* alternative streams */
 
 /* CVS revision and version */
 static char revisionstr[] = "$Revision: 1.51 $";
@@ -84,13 +126,38 @@ struct Args
 
   int         udpport;
   int         initudp;
-  enum SerialBaud baud;
+  int         baud;
   enum SerialDatabits databits;
   enum SerialStopbits stopbits;
   enum SerialParity parity;
   enum SerialProtocol protocol;
   const char *serdevice;
   const char *serlogfile;
+  const char *gateway;
+  int         frames;
+  int         serqueue;
+  int         overflow;
+  int         latency;
+  const char *listen[MAXLISTEN];
+  int         numlisten;
+  const char *metrics;
+  const char *stcache;
+  int         stmaxage;
+  const char *query;
+  int         nearest;
+  const char *standby[MAXSTANDBY];
+  int         numstandby;
+  int         stall;
+  const char *merge;
+  int         batch;
+  int         batchwait;
+  int         ggaperiod;
+  int         ggamove;
+  int         sermaxage;
+  int         epochwait;
+  int         vmin;
+  int         vtime;
+  int         lowlatency;
 };
 
 /* option parsing */
@@ -119,21 +186,51 @@ static struct option opts[] = {
 { "parity",     required_argument, 0, 'Y'},
 { "databits",   required_argument, 0, 'A'},
 { "serlogfile", required_argument, 0, 'l'},
+{ "serread",    required_argument, 0, 'k'},
+{ "lowlatency", no_argument,       0, 'y'},
+{ "gateway",    required_argument, 0, 'G'},
+{ "frames",     no_argument,       0, 'F'},
+{ "serqueue",   required_argument, 0, 'Q'},
+{ "overflow",   required_argument, 0, 'O'},
+{ "latency",    required_argument, 0, 'J'},
+{ "listen",     required_argument, 0, 'L'},
+{ "metrics",    required_argument, 0, 'E'},
+{ "stcache",    required_argument, 0, 'K'},
+{ "stmaxage",   required_argument, 0, 'W'},
+{ "nearest",    required_argument, 0, 'N'},
+{ "standby",    required_argument, 0, 'a'},
+{ "stall",      required_argument, 0, 't'},
+{ "merge",      required_argument, 0, 'x'},
+{ "batch",      required_argument, 0, 'U'},
+{ "batchwait",  required_argument, 0, 'V'},
+{ "epochwait",  required_argument, 0, 'w'},
+{ "ggaperiod",  required_argument, 0, 'g'},
+{ "ggamove",    required_argument, 0, 'j'},
+{ "sermaxage",  required_argument, 0, 'e'},
 { "help",       no_argument,       0, 'h'},
 {0,0,0,0}};
 #endif
-#define ARGOPT "-d:m:bhp:r:s:u:n:S:R:M:IP:D:B:T:C:Y:A:l:"
+#define ARGOPT "-d:m:bhp:r:s:u:n:S:R:M:IP:D:B:T:C:Y:A:l:G:FQ:O:J:L:E:K:W:N:a:t:x:U:V:g:j:e:w:k:y"
 
 int stop = 0;
 #ifndef WINDOWSVERSION
 int sigstop = 0;
+/* connection which is closed when no data arrives */
+volatile sockettype alarmsocket = -1;
 #ifdef __GNUC__
-static __attribute__ ((noreturn)) void sighandler_alarm(
-int sig __attribute__((__unused__)))
+static void sighandler_alarm(int sig __attribute__((__unused__)))
 #else /* __GNUC__ */
 static void sighandler_alarm(int sig)
 #endif /* __GNUC__ */
 {
+  if(!sigstop && alarmsocket != -1)
+  {
+    /* the receive loop sees the closed connection and reconnects */
+    fprintf(stderr, "ERROR: more than %d seconds no activity\n", ALARMTIME);
+    shutdown(alarmsocket, SHUT_RDWR);
+    alarm(ALARMTIME);
+    return;
+  }
   if(!sigstop)
     fprintf(stderr, "ERROR: more than %d seconds no activity\n", ALARMTIME);
   else
@@ -177,11 +274,34 @@ static const char *encodeurl(const char *req)
   return buf;
 }
 
-static const char *geturl(const char *url, struct Args *args)
+/* reverses encodeurl() */
+static const char *decodeurl(const char *req)
 {
-  static char buf[1000];
-  static char *Buffer = buf;
-  static char *Bufend = buf+sizeof(buf);
+  static char buf[128];
+  char *urldec = buf;
+  char *bufend = buf + sizeof(buf) - 1;
+
+  while(*req && urldec < bufend)
+  {
+    if(*req == '%' && isxdigit((unsigned char)req[1])
+    && isxdigit((unsigned char)req[2]))
+    {
+      char h[3] = {req[1], req[2], 0};
+      *urldec++ = strtol(h, 0, 16);
+      req += 3;
+    }
+    else
+      *urldec++ = *req++;
+  }
+  *urldec = 0;
+  return buf;
+}
+
+/* parses an ntrip: URL, the strings are stored starting at *bufpos */
+static const char *parseurl(const char *url, struct Args *args, char **bufpos,
+char *Bufend)
+{
+  char *Buffer = *bufpos;
   char *h = "0123456789abcdef";
 
   if(strncmp("ntrip:", url, 6))
@@ -249,6 +369,11 @@ static const char *geturl(const char *url, struct Args *args)
     if(*url != '@' && *url != ':')
     {
       args->server = Buffer;
+      if(*url == '[') /* IPv6 address */
+      {
+        while(*url && *url != ']' && Buffer != Bufend)
+          *(Buffer++) = *(url++);
+      }
       while(*url && *url != '@' && *url != ':' && *url != ';' && Buffer != Bufend)
         *(Buffer++) = *(url++);
       if(Buffer == args->server)
@@ -275,6 +400,11 @@ static const char *geturl(const char *url, struct Args *args)
     {
       ++url;
       args->proxyhost = Buffer;
+      if(*url == '[') /* IPv6 address */
+      {
+        while(*url && *url != ']' && Buffer != Bufend)
+          *(Buffer++) = *(url++);
+      }
       while(*url && *url != ':' && *url != ';' && Buffer != Bufend)
         *(Buffer++) = *(url++);
       if(Buffer == args->proxyhost)
@@ -304,9 +434,36 @@ static const char *geturl(const char *url, struct Args *args)
       ++url;
   }
 
+  *bufpos = Buffer;
   return *url ? "Garbage at end of server string." : 0;
 }
 
+static const char *geturl(const char *url, struct Args *args)
+{
+  static char buf[1000];
+  static char *Buffer = buf;
+
+  return parseurl(url, args, &Buffer, buf+sizeof(buf));
+}
+
+/* returns the mode for a mode name or number, 0 when unknown */
+static int getmode(const char *name)
+{
+  int mode = 0;
+  if (!strcmp(name,"n") || !strcmp(name,"ntrip1"))
+    mode = NTRIP1;
+  else if(!strcmp(name,"h") || !strcmp(name,"http"))
+    mode = HTTP;
+  else if(!strcmp(name,"r") || !strcmp(name,"rtsp"))
+    mode = RTSP;
+  else if(!strcmp(name,"u") || !strcmp(name,"udp"))
+    mode = UDP;
+  else if(!strcmp(name,"a") || !strcmp(name,"auto"))
+    mode = AUTO;
+  else mode = atoi(name);
+  return (mode <= 0 || mode >= END) ? 0 : mode;
+}
+
 static int getargs(int argc, char **argv, struct Args *args)
 {
   int res = 1;
@@ -330,9 +487,32 @@ static int getargs(int argc, char **argv, struct Args *args)
   args->parity = SPAPARITY_NONE;
   args->stopbits = SPASTOPBITS_1;
   args->databits = SPADATABITS_8;
-  args->baud = SPABAUD_9600;
+  args->baud = 9600;
+  args->vmin = 1;
+  args->vtime = 0;
+  args->lowlatency = 0;
   args->serdevice = 0;
   args->serlogfile = 0;
+  args->gateway = 0;
+  args->frames = 0;
+  args->serqueue = 0;
+  args->latency = 100;
+  args->overflow = 0;
+  args->numlisten = 0;
+  args->metrics = 0;
+  args->stcache = 0;
+  args->stmaxage = 3600;
+  args->query = 0;
+  args->nearest = 0;
+  args->numstandby = 0;
+  args->stall = 500;
+  args->merge = 0;
+  args->batch = 8192;
+  args->batchwait = 1000;
+  args->epochwait = 200;
+  args->ggaperiod = 1000;
+  args->ggamove = 0;
+  args->sermaxage = 0;
   help = 0;
 
   do
@@ -355,30 +535,26 @@ static int getargs(int argc, char **argv, struct Args *args)
         args->data = optarg;
       break;
     case 'B':
+      if((args->baud = strtol(optarg, &a, 10)) <= 0 || *a)
       {
-        int i = strtol(optarg, 0, 10);
-
-        switch(i)
-        {
-        case 50: args->baud = SPABAUD_50; break;
-        case 110: args->baud = SPABAUD_110; break;
-        case 300: args->baud = SPABAUD_300; break;
-        case 600: args->baud = SPABAUD_600; break;
-        case 1200: args->baud = SPABAUD_1200; break;
-        case 2400: args->baud = SPABAUD_2400; break;
-        case 4800: args->baud = SPABAUD_4800; break;
-        case 9600: args->baud = SPABAUD_9600; break;
-        case 19200: args->baud = SPABAUD_19200; break;
-        case 38400: args->baud = SPABAUD_38400; break;
-        case 57600: args->baud = SPABAUD_57600; break;
-        case 115200: args->baud = SPABAUD_115200; break;
-        default:
-          fprintf(stderr, "Baudrate '%s' unknown\n", optarg);
-          res = 0;
-          break;
-        }
+        fprintf(stderr, "Baudrate '%s' unknown\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'k':
+      args->vmin = strtol(optarg, &a, 10);
+      if(*a == ',')
+        args->vtime = strtol(a+1, &a, 10);
+      if(*a || args->vmin < 0 || args->vmin > 255 || args->vtime < 0
+      || args->vtime > 255)
+      {
+        fprintf(stderr, "Serial read setting '%s' invalid\n", optarg);
+        res = 0;
       }
       break;
+    case 'y':
+      args->lowlatency = 1;
+      break;
     case 'T':
       if(!strcmp(optarg, "1")) args->stopbits = SPASTOPBITS_1;
       else if(!strcmp(optarg, "2")) args->stopbits = SPASTOPBITS_2;
@@ -421,8 +597,118 @@ static int getargs(int argc, char **argv, struct Args *args)
         }
       }
       break;
+    case 'Q':
+      if((args->serqueue = strtol(optarg, 0, 10)) <= 0)
+      {
+        fprintf(stderr, "Serial queue size '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'O':
+      if(!strcmp(optarg, "drop")) args->overflow = 0;
+      else if(!strcmp(optarg, "block")) args->overflow = 1;
+      else
+      {
+        fprintf(stderr, "Overflow handling '%s' unknown\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'e':
+      if((args->sermaxage = strtol(optarg, &a, 10)) < 0 || *a)
+      {
+        fprintf(stderr, "Serial data age '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'U':
+      if((args->batch = strtol(optarg, &a, 10)) < 0 || *a)
+      {
+        fprintf(stderr, "Batch size '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'V':
+      if((args->batchwait = strtol(optarg, &a, 10)) < 0 || *a)
+      {
+        fprintf(stderr, "Batch time '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'g':
+      if((args->ggaperiod = strtol(optarg, &a, 10)) < 0 || *a)
+      {
+        fprintf(stderr, "GGA period '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'j':
+      if((args->ggamove = strtol(optarg, &a, 10)) < 0 || *a)
+      {
+        fprintf(stderr, "GGA distance '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'w':
+      if((args->epochwait = strtol(optarg, &a, 10)) < 0 || *a)
+      {
+        fprintf(stderr, "Epoch time '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'J':
+      if((args->latency = strtol(optarg, &a, 10)) < 0 || *a)
+      {
+        fprintf(stderr, "Latency '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'L':
+      if(args->numlisten < MAXLISTEN)
+        args->listen[args->numlisten++] = optarg;
+      else
+      {
+        fprintf(stderr, "Too many listening addresses\n");
+        res = 0;
+      }
+      break;
+    case 'E': args->metrics = optarg; break;
+    case 'x': args->merge = optarg; break;
+    case 'K': args->stcache = optarg; break;
+    case 'N':
+      if((args->nearest = strtol(optarg, &a, 10)) <= 0
+      || args->nearest > SOURCETABLEMAXNEAR || *a)
+      {
+        fprintf(stderr, "Number of nearest streams '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'a':
+      if(args->numstandby < MAXSTANDBY)
+        args->standby[args->numstandby++] = optarg;
+      else
+      {
+        fprintf(stderr, "Too many standby streams\n");
+        res = 0;
+      }
+      break;
+    case 't':
+      if((args->stall = strtol(optarg, &a, 10)) <= 0 || *a)
+      {
+        fprintf(stderr, "Stall time '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
+    case 'W':
+      if((args->stmaxage = strtol(optarg, &a, 10)) < 0 || *a)
+      {
+        fprintf(stderr, "Sourcetable cache age '%s' invalid\n", optarg);
+        res = 0;
+      }
+      break;
     case 'D': args->serdevice = optarg; break;
     case 'l': args->serlogfile = optarg; break;
+    case 'G': args->gateway = optarg; break;
+    case 'F': args->frames = 1; break;
     case 'I': args->initudp = 1; break;
     case 'P': args->udpport = strtol(optarg, 0, 10); break;
     case 'n': args->nmea = optarg; break;
@@ -432,19 +718,8 @@ static int getargs(int argc, char **argv, struct Args *args)
     case 'S': args->proxyhost = optarg; break;
     case 'R': args->proxyport = optarg; break;
     case 'M':
-      args->mode = 0;
-      if (!strcmp(optarg,"n") || !strcmp(optarg,"ntrip1"))
-        args->mode = NTRIP1;
-      else if(!strcmp(optarg,"h") || !strcmp(optarg,"http"))
-        args->mode = HTTP;
-      else if(!strcmp(optarg,"r") || !strcmp(optarg,"rtsp"))
-        args->mode = RTSP;
-      else if(!strcmp(optarg,"u") || !strcmp(optarg,"udp"))
-        args->mode = UDP;
-      else if(!strcmp(optarg,"a") || !strcmp(optarg,"auto"))
-        args->mode = AUTO;
-      else args->mode = atoi(optarg);
-      if((args->mode == 0) || (args->mode >= END))
+      args->mode = getmode(optarg);
+      if(!args->mode)
       {
         fprintf(stderr, "Mode %s unknown\n", optarg);
         res = 0;
@@ -501,6 +776,27 @@ static int getargs(int argc, char **argv, struct Args *args)
     " -P " LONG_OPT("--udpport    ") "set the local UDP port\n"
     " -S " LONG_OPT("--proxyhost  ") "proxy name or address\n"
     " -R " LONG_OPT("--proxyport  ") "proxy port, optional (default 2101)\n"
+    " -G " LONG_OPT("--gateway    ") "file with a list of streams to fetch in one process\n"
+    " -F " LONG_OPT("--frames     ") "output only complete RTCM3 frames with valid checksum\n"
+    " -J " LONG_OPT("--latency    ") "time in ms RTP packets wait for reordering (default 100)\n"
+    " -L " LONG_OPT("--listen     ") "serve the data to local clients at [host:]port or at\n"
+    "                  a Unix socket path, may be given up to 4 times\n"
+    " -E " LONG_OPT("--metrics    ") "serve Prometheus metrics at [host:]port\n"
+    " -K " LONG_OPT("--stcache    ") "sourcetable cache file, queries are evaluated locally\n"
+    " -W " LONG_OPT("--stmaxage   ") "seconds the sourcetable cache is used (default 3600)\n"
+    " -N " LONG_OPT("--nearest    ") "request the stream nearest to the GGA position and\n"
+    "                  list the given number of nearest streams\n"
+    " -a " LONG_OPT("--standby    ") "ntrip: URL of a stream which is kept connected and\n"
+    "                  used when the data stalls, may be given up to 4 times\n"
+    " -t " LONG_OPT("--stall      ") "minimum time in ms without data until the standby\n"
+    "                  stream is used (default 500)\n"
+    " -x " LONG_OPT("--merge      ") "ntrip: URL of a second path to the same stream, the\n"
+    "                  first copy of each RTCM3 frame is output\n"
+    " -U " LONG_OPT("--batch      ") "bytes of standard output written at once, 0 writes\n"
+    "                  each block at once (default 8192)\n"
+    " -V " LONG_OPT("--batchwait  ") "time in us output data waits at most (default 1000)\n"
+    " -w " LONG_OPT("--epochwait  ") "time in ms the messages of an epoch are held until\n"
+    "                  it is complete, with -F (default 200, 0 off)\n"
     "\nSerial input/output:\n"
     " -D " LONG_OPT("--serdevice  ") "serial device for output\n"
     " -B " LONG_OPT("--baud       ") "baudrate for serial device\n"
@@ -509,6 +805,18 @@ static int getargs(int argc, char **argv, struct Args *args)
     " -Y " LONG_OPT("--parity     ") "parity for serial device\n"
     " -A " LONG_OPT("--databits   ") "databits for serial device\n"
     " -l " LONG_OPT("--serlogfile ") "logfile for serial data\n"
+    " -k " LONG_OPT("--serread    ") "VMIN[,VTIME] of the serial device (default 1,0)\n"
+    " -y " LONG_OPT("--lowlatency ") "set the low latency flag of the serial driver\n"
+    " -Q " LONG_OPT("--serqueue   ") "size of the serial output queue in bytes, the\n"
+    "                  serial device is written by a separate thread\n"
+    " -O " LONG_OPT("--overflow   ") "handling of a full serial output queue:\n"
+    "                  drop (oldest data, default) or block\n"
+    " -e " LONG_OPT("--sermaxage  ") "maximum age in ms of data when it is sent over the\n"
+    "                  serial device, older data is dropped (default 0, off)\n"
+    " -g " LONG_OPT("--ggaperiod  ") "time in ms between the GGA sentences of the serial\n"
+    "                  device sent to the caster (default 1000)\n"
+    " -j " LONG_OPT("--ggamove    ") "distance in m after which a GGA sentence is sent\n"
+    "                  at once (default 0, off)\n"
     , revisionstr, datestr, argv[0], argv[0]);
     exit(1);
   }
@@ -564,143 +872,3365 @@ static int encode(char *buf, int size, const char *user, const char *pwd)
   return bytes;
 }
 
-int main(int argc, char **argv)
+#define MAXADDRESSES     8
+#define ADDRESSCACHETIME 300   /* seconds a name lookup is used */
+#define CONNECTDELAY     250   /* ms before the next address is tried */
+#define CONNECTTIMEOUT   30000 /* ms */
+
+struct address
 {
-  struct Args args;
+  struct sockaddr_storage addr[MAXADDRESSES];
+  socklen_t               len[MAXADDRESSES];
+  int                     num;
+};
 
-  setbuf(stdout, 0);
-  setbuf(stdin, 0);
-  setbuf(stderr, 0);
+struct addresscache
+{
+  struct addresscache *next;
+  char                *host;
+  char                *port;
+  int                  socktype;
+  struct address       address;
+  time_t               expires;
+  int                  refresh; /* lookup running in the background */
+  int                  error;   /* getaddrinfo() error of that lookup */
+};
+
+static struct addresscache *addresscache = 0;
 #ifndef WINDOWSVERSION
-  signal(SIGALRM,sighandler_alarm);
-  signal(SIGINT,sighandler_int);
-  alarm(ALARMTIME);
+static pthread_mutex_t addresscachelock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCKADDRESSCACHE   pthread_mutex_lock(&addresscachelock)
+#define UNLOCKADDRESSCACHE pthread_mutex_unlock(&addresscachelock)
 #else
-  WSADATA wsaData;
-  if(WSAStartup(MAKEWORD(1,1),&wsaData))
+#define LOCKADDRESSCACHE
+#define UNLOCKADDRESSCACHE
+#endif
+
+/* returns a time in milliseconds for measuring durations */
+static double mstime(void)
+{
+#ifdef WINDOWSVERSION
+  return GetTickCount();
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1000.0 + t.tv_nsec/1000000.0;
+#endif
+}
+
+/* UTC in ms since 1970 */
+static double utctime(void)
+{
+#ifdef WINDOWSVERSION
+  FILETIME f;
+  GetSystemTimeAsFileTime(&f);
+  return ((((unsigned long long)f.dwHighDateTime << 32) | f.dwLowDateTime)
+  - 116444736000000000ULL) / 10000.0;
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  return t.tv_sec*1000.0 + t.tv_nsec/1000000.0;
+#endif
+}
+
+static int setnonblocking(sockettype sock, int on)
+{
+#ifdef WINDOWSVERSION
+  u_long blockmode = on;
+  return ioctlsocket(sock, FIONBIO, &blockmode) ? -1 : 0;
+#else
+  int fl = fcntl(sock, F_GETFL);
+  if(fl < 0)
+    return -1;
+  return fcntl(sock, F_SETFL, on ? fl | O_NONBLOCK : fl & ~O_NONBLOCK);
+#endif
+}
+
+static void setport(struct sockaddr_storage *addr, int port)
+{
+  if(addr->ss_family == AF_INET6)
+    ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+  else
+    ((struct sockaddr_in *)addr)->sin_port = htons(port);
+}
+
+/* fills in the local wildcard address for the address family */
+static socklen_t localaddress(struct sockaddr_storage *addr, int family,
+int port)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->ss_family = family;
+  setport(addr, port);
+  return family == AF_INET6 ? sizeof(struct sockaddr_in6)
+  : sizeof(struct sockaddr_in);
+}
+
+/* does the name lookup, the result alternates between the address
+   families starting with the preferred one, returns 0 or the
+   getaddrinfo() error */
+static int lookupaddress(const char *host, const char *port, int socktype,
+struct address *a)
+{
+  struct addrinfo hints, *res, *r;
+  struct addrinfo *first[MAXADDRESSES], *other[MAXADDRESSES];
+  int i, j, nfirst = 0, nother = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = socktype;
+  if((i = getaddrinfo(host, port, &hints, &res)))
+    return i;
+  for(r = res; r; r = r->ai_next)
   {
-    fprintf(stderr, "Could not init network access.\n");
-    return 20;
+    if(r->ai_family == res->ai_family && nfirst < MAXADDRESSES)
+      first[nfirst++] = r;
+    else if(r->ai_family != res->ai_family && nother < MAXADDRESSES)
+      other[nother++] = r;
+  }
+  a->num = 0;
+  for(i = j = 0; a->num < MAXADDRESSES && (i < nfirst || j < nother);)
+  {
+    r = (i < nfirst && (i <= j || j == nother)) ? first[i++] : other[j++];
+    memcpy(&a->addr[a->num], r->ai_addr, r->ai_addrlen);
+    a->len[a->num++] = r->ai_addrlen;
+  }
+  freeaddrinfo(res);
+  return 0;
+}
+
+#ifndef WINDOWSVERSION
+static void *refreshaddress(void *data)
+{
+  struct addresscache *c = data;
+  struct address a;
+  int res = lookupaddress(c->host, c->port, c->socktype, &a);
+
+  LOCKADDRESSCACHE;
+  if(!res)
+    c->address = a;
+  /* on errors the old addresses are used a bit longer */
+  c->expires = time(0) + (res ? 10 : ADDRESSCACHETIME);
+  c->error = res;
+  c->refresh = 0;
+  UNLOCKADDRESSCACHE;
+  return 0;
+}
+#endif
+
+/* returns 1 when a background lookup was started */
+static int startrefresh(struct addresscache *c)
+{
+#ifndef WINDOWSVERSION
+  pthread_t thread;
+  if(!c->refresh)
+  {
+    if(pthread_create(&thread, 0, refreshaddress, c))
+      return 0;
+    pthread_detach(thread);
+    c->refresh = 1;
   }
+  return 1;
+#else
+  return 0;
 #endif
+}
 
-  if(getargs(argc, argv, &args))
+/* IPv6 addresses may be given in brackets like in URLs */
+static const char *hostname(const char *host, char *name, size_t size)
+{
+  size_t l = strlen(host);
+  if(*host != '[' || l < 3 || l >= size || host[l-1] != ']')
+    return host;
+  memcpy(name, host+1, l-2);
+  name[l-2] = 0;
+  return name;
+}
+
+static struct addresscache *findaddress(const char *host, const char *port,
+int socktype)
+{
+  struct addresscache *c;
+  for(c = addresscache; c && (c->socktype != socktype
+  || strcmp(c->host, host) || strcmp(c->port, port)); c = c->next)
+    ;
+  return c;
+}
+
+/* adds an empty entry to the cache, returns 0 on errors */
+static struct addresscache *newaddress(const char *host, const char *port,
+int socktype)
+{
+  struct addresscache *c = calloc(1, sizeof(*c));
+  if(c && (c->host = strdup(host)) && (c->port = strdup(port)))
   {
-    struct serial sx;
-    FILE *ser = 0;
-    char nmeabuffer[200] = "$GPGGA,"; /* our start string */
-    size_t nmeabufpos = 0;
-    size_t nmeastarpos = 0;
-    int sleeptime = 0;
-    if(args.serdevice)
+    c->socktype = socktype;
+    c->next = addresscache;
+    addresscache = c;
+    return c;
+  }
+  if(c)
+    free(c->host);
+  free(c);
+  return 0;
+}
+
+/* returns the addresses for host and port, an outdated cache entry is
+   used while the lookup is repeated in the background, returns 0 on
+   success, 1 on errors which may vanish later and 2 for unknown ports;
+   without wait a missing name is looked up in the background and -1 is
+   returned until the entry is filled */
+static int resolve(const char *host, const char *port, int socktype,
+struct address *a, int verbose, int wait)
+{
+  struct addresscache *c;
+  char name[256];
+  double t;
+  int i = 0;
+
+  host = hostname(host, name, sizeof(name));
+  LOCKADDRESSCACHE;
+  c = findaddress(host, port, socktype);
+  if(c && c->address.num && (time(0) < c->expires || startrefresh(c)))
+  {
+    *a = c->address;
+    UNLOCKADDRESSCACHE;
+    return 0;
+  }
+  if(!wait && (c || (c = newaddress(host, port, socktype))))
+  {
+    /* a failed lookup is reported until the entry expires */
+    if(!c->refresh && c->error && time(0) < c->expires)
+      i = c->error;
+    else if(startrefresh(c))
+      i = -1;
+  }
+  UNLOCKADDRESSCACHE;
+  if(i == -1)
+    return -1;
+
+  t = mstime();
+  if(i || (i = lookupaddress(host, port, socktype, a)))
+  {
+    if(i == EAI_SERVICE)
     {
-      const char *e = SerialInit(&sx, args.serdevice, args.baud,
-      args.stopbits, args.protocol, args.parity, args.databits, 1);
-      if(e)
+      fprintf(stderr, "Can't resolve port %s.\n", port);
+      return 2;
+    }
+    fprintf(stderr, "Server name lookup failed for '%s'.\n", host);
+    return 1;
+  }
+  if(verbose)
+    fprintf(stderr, "Name lookup for %s took %.1f ms (%d addresses).\n",
+    host, mstime()-t, a->num);
+
+  LOCKADDRESSCACHE;
+  if((c = findaddress(host, port, socktype))
+  || (c = newaddress(host, port, socktype)))
+  {
+    c->address = *a;
+    c->expires = time(0) + ADDRESSCACHETIME;
+    c->error = 0;
+  }
+  UNLOCKADDRESSCACHE;
+  return 0;
+}
+
+/* the next resolve() looks up the name again */
+static void forgetaddress(const struct Args *args, int socktype)
+{
+  struct addresscache *c;
+  char name[256];
+  const char *host = hostname(args->proxyhost ? args->proxyhost
+  : args->server, name, sizeof(name));
+  LOCKADDRESSCACHE;
+  if((c = findaddress(host, args->proxyhost ? args->proxyport : args->port,
+  socktype)))
+  {
+    c->address.num = 0;
+    c->error = 0;
+  }
+  UNLOCKADDRESSCACHE;
+}
+
+/* resolves the addresses to connect to, returns 0 on success, 1 on errors
+   which may vanish later and 2 if trying again makes no sense, without
+   wait -1 while the name is looked up in the background */
+static int getaddress(const struct Args *args, int socktype,
+struct address *a, const char **proxyserver, char *proxyport,
+size_t proxyportsize, int wait)
+{
+  *proxyserver = 0;
+  if(args->proxyhost)
+  {
+    struct servent *se;
+    char *b;
+    long i;
+    int p;
+    if((i = strtol(args->port, &b, 10)) && (!b || !*b))
+      p = i;
+    else if(!(se = getservbyname(args->port, 0)))
+    {
+      fprintf(stderr, "Can't resolve port %s.", args->port);
+      return 2;
+    }
+    else
+    {
+      p = ntohs(se->s_port);
+    }
+    snprintf(proxyport, proxyportsize, "%d", p);
+    *proxyserver = args->server;
+    return resolve(args->proxyhost, args->proxyport, socktype, a,
+    args->bitrate, wait);
+  }
+  return resolve(args->server, args->port, socktype, a, args->bitrate, wait);
+}
+
+static void printaddress(const char *text, const struct sockaddr_storage *addr,
+socklen_t len, double ms)
+{
+  char host[64];
+  if(getnameinfo((const struct sockaddr *)addr, len, host, sizeof(host), 0, 0,
+  NI_NUMERICHOST))
+    strcpy(host, "?");
+  fprintf(stderr, "%s %s in %.1f ms.\n", text, host, ms);
+}
+
+/* connects to the first address which answers, while attempts are pending
+   the next address is tried every CONNECTDELAY ms (Happy Eyeballs), gives
+   up when wake (-1 for none) gets readable, returns the connected blocking
+   socket or -1 */
+static sockettype connectrace(const struct address *a,
+struct sockaddr_storage *addr, socklen_t *len, int verbose, sockettype wake)
+{
+  sockettype s[MAXADDRESSES];
+  int started = 0, pending = 0, win = -1, i, err = 0, woken = 0;
+  double start = mstime(), next = start;
+
+  while(win < 0 && !stop)
+  {
+    double now = mstime(), wait;
+    struct timeval tv;
+    fd_set fdr, fdw, fde;
+    sockettype maxfd = wake != -1 ? wake : 0;
+
+    if(started < a->num && (now >= next || !pending))
+    {
+      i = started++;
+      if((s[i] = socket(a->addr[i].ss_family, SOCK_STREAM, 0)) == -1
+      || setnonblocking(s[i], 1) < 0)
+        err = socketerror();
+      else if(!connect(s[i], (struct sockaddr *)&a->addr[i], a->len[i]))
+        win = i;
+      else if(CONNECTPENDING(socketerror()))
       {
-        fprintf(stderr, "%s\n", e);
-        return 20;
+        ++pending;
+        next = now + CONNECTDELAY;
+        continue;
       }
-      if(args.serlogfile)
+      else
+        err = socketerror();
+      if(win < 0 && s[i] != -1)
       {
-        if(!(ser = fopen(args.serlogfile, "a+")))
-        {
-          SerialFree(&sx);
-          fprintf(stderr, "Could not open serial logfile.\n");
-          return 20;
-        }
+        closesocket(s[i]);
+        s[i] = -1;
       }
+      continue;
     }
-    do
+    if(!pending)
+      break;
+    if(now - start > CONNECTTIMEOUT)
     {
-      int error = 0;
-      sockettype sockfd = 0;
-      int numbytes;
-      char buf[MAXDATASIZE];
-      struct sockaddr_in their_addr; /* connector's address information */
-      struct hostent *he;
-      struct servent *se;
-      const char *server, *port, *proxyserver = 0;
-      char proxyport[6];
-      char *b;
-      long i;
-      if(sleeptime)
+      err = ETIMEDOUT;
+      break;
+    }
+    FD_ZERO(&fdr);
+    FD_ZERO(&fdw);
+    FD_ZERO(&fde);
+    if(wake != -1)
+      FD_SET(wake, &fdr);
+    for(i = 0; i < started; ++i)
+    {
+      if(s[i] != -1)
       {
-#ifdef WINDOWSVERSION
-        Sleep(sleeptime*1000);
-#else
-        sleep(sleeptime);
-#endif
-        sleeptime += 2;
+        FD_SET(s[i], &fdw);
+        FD_SET(s[i], &fde);
+        if(s[i] > maxfd)
+          maxfd = s[i];
       }
-      else
+    }
+    wait = (started < a->num ? next : start + CONNECTTIMEOUT) - now;
+    if(wait < 0)
+      wait = 0;
+    tv.tv_sec = wait / 1000;
+    tv.tv_usec = ((long)wait % 1000) * 1000;
+    if(select(maxfd+1, &fdr, &fdw, &fde, &tv) < 0)
+      continue;
+    if(wake != -1 && FD_ISSET(wake, &fdr))
+    {
+      woken = 1;
+      break;
+    }
+    for(i = 0; i < started && win < 0; ++i)
+    {
+      if(s[i] != -1 && (FD_ISSET(s[i], &fdw) || FD_ISSET(s[i], &fde)))
+      {
+        int e = 0;
+        socklen_t l = sizeof(e);
+        if(getsockopt(s[i], SOL_SOCKET, SO_ERROR, (char *)&e, &l) < 0)
+          e = socketerror();
+        if(!e)
+          win = i;
+        else
+        {
+          err = e;
+          closesocket(s[i]);
+          s[i] = -1;
+          --pending;
+          next = now; /* try the next address immediately */
+        }
+      }
+    }
+  }
+  for(i = 0; i < started; ++i)
+  {
+    if(i != win && s[i] != -1)
+      closesocket(s[i]);
+  }
+  if(win < 0)
+  {
+    if(!stop && !woken)
+      printsocketerror("connect", err);
+    return -1;
+  }
+  setnonblocking(s[win], 0);
+  *addr = a->addr[win];
+  *len = a->len[win];
+  if(verbose)
+    printaddress("Connected to", addr, *len, mstime()-start);
+  return s[win];
+}
+
+#define RECONNECTBASE    1000  /* ms, backoff for the second retry */
+#define RECONNECTMAX     60000 /* ms, upper limit of the backoff */
+#define RECONNECTHEALTHY 10000 /* ms of data until the backoff is reset */
+
+struct reconnect
+{
+  int           attempts; /* connects since the stream was healthy */
+  double        down;     /* time the data stopped, 0 while it flows */
+  double        up;       /* time the data started, 0 while down */
+  unsigned long count;    /* reconnections */
+  double        total;    /* summed outage time in ms */
+  double        max;      /* longest outage in ms */
+};
+
+/* returns the time in ms to wait before the next connect, the first retry
+   is done immediately, afterwards the delay is chosen randomly up to an
+   exponentially growing limit (full jitter), so that many clients losing
+   the same caster do not come back at the same moment */
+static double reconnectdelay(struct reconnect *r)
+{
+  double limit = RECONNECTBASE;
+  int i;
+
+  if(!r->down || !r->attempts++)
+    return 0; /* first connect or first retry */
+  for(i = 2; i < r->attempts && limit < RECONNECTMAX; ++i)
+    limit *= 2;
+  if(limit > RECONNECTMAX)
+    limit = RECONNECTMAX;
+  return limit * rand() / RAND_MAX;
+}
+
+/* the connection ended or could not be made */
+static void reconnectlost(struct reconnect *r)
+{
+  if(!r->down)
+    r->down = mstime();
+  r->up = 0;
+}
+
+/* data arrived, updates the outage statistics, returns the length of the
+   outage in ms when the data came back after a reconnect or 0 */
+static double reconnectdata(struct reconnect *r)
+{
+  double now, d = 0;
+
+  if(r->up && !r->attempts)
+    return 0;
+  now = mstime();
+  if(!r->up)
+  {
+    r->up = now;
+    if(r->down)
+    {
+      d = now - r->down;
+      ++r->count;
+      r->total += d;
+      if(d > r->max)
+        r->max = d;
+      r->down = 0;
+    }
+  }
+  else if(now - r->up > RECONNECTHEALTHY)
+    r->attempts = 0;
+  return d;
+}
+
+static void reconnectstats(const char *name, const struct reconnect *r)
+{
+  if(r->count)
+    fprintf(stderr, "%s%sReconnects: %lu, outage mean %.1f s, max %.1f s.\n",
+    name ? name : "", name ? ": " : "", r->count, r->total/r->count/1000.0,
+    r->max/1000.0);
+}
+
+/* waits the given time in ms or until the program is stopped */
+static void waitms(double ms)
+{
+  double end = mstime() + ms;
+
+  while(!stop && (ms = end - mstime()) > 0)
+  {
+#ifdef WINDOWSVERSION
+    Sleep(ms > 100 ? 100 : (DWORD)ms);
+#else
+    struct timespec t;
+    t.tv_sec = ms / 1000;
+    t.tv_nsec = ((long)ms % 1000) * 1000000;
+    nanosleep(&t, 0);
+#endif
+  }
+}
+
+/* creates the request for the TCP based modes (HTTP and NTRIP1), returns
+   the request length or -1 in case the request cannot be created */
+static int buildrequest(char *buf, int size, const struct Args *args,
+const char *proxyserver, const char *proxyport)
+{
+  int i;
+
+  if(!args->data)
+  {
+    i = snprintf(buf, size,
+    "GET %s%s%s%s/ HTTP/1.1\r\n"
+    "Host: %s\r\n%s"
+    "User-Agent: %s/%s\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    , proxyserver ? "http://" : "", proxyserver ? proxyserver : "",
+    proxyserver ? ":" : "", proxyserver ? proxyport : "",
+    args->server, args->mode == NTRIP1 ? "" : "Ntrip-Version: Ntrip/2.0\r\n",
+    AGENTSTRING, revisionstr);
+    if(i >= size || i < 0)
+    {
+      fprintf(stderr, "Requested data too long\n");
+      return -1;
+    }
+  }
+  else
+  {
+    const char *nmeahead = (args->nmea && args->mode == HTTP) ? args->nmea : 0;
+
+    i=snprintf(buf, size-40, /* leave some space for login */
+    "GET %s%s%s%s/%s HTTP/1.1\r\n"
+    "Host: %s\r\n%s"
+    "User-Agent: %s/%s\r\n"
+    "%s%s%s"
+    "Connection: close%s"
+    , proxyserver ? "http://" : "", proxyserver ? proxyserver : "",
+    proxyserver ? ":" : "", proxyserver ? proxyport : "",
+    args->data, args->server,
+    args->mode == NTRIP1 ? "" : "Ntrip-Version: Ntrip/2.0\r\n",
+    AGENTSTRING, revisionstr,
+    nmeahead ? "Ntrip-GGA: " : "", nmeahead ? nmeahead : "",
+    nmeahead ? "\r\n" : "",
+    (*args->user || *args->password) ? "\r\nAuthorization: Basic " : "");
+    if(i > size-40 || i < 0) /* second check for old glibc */
+    {
+      fprintf(stderr, "Requested data too long\n");
+      return -1;
+    }
+    i += encode(buf+i, size-i-4, args->user, args->password);
+    if(i > size-4)
+    {
+      fprintf(stderr, "Username and/or password too long\n");
+      return -1;
+    }
+    buf[i++] = '\r';
+    buf[i++] = '\n';
+    buf[i++] = '\r';
+    buf[i++] = '\n';
+    if(args->nmea && !nmeahead)
+    {
+      int j = snprintf(buf+i, size-i, "%s\r\n", args->nmea);
+      if(j >= 0 && j < size-i)
+        i += j;
+      else
+      {
+        fprintf(stderr, "NMEA string too long\n");
+        return -1;
+      }
+    }
+  }
+  return i;
+}
+
+struct chunky
+{
+  int mode; /* 0 when transfer is not chunked, otherwise decoder state */
+  int size; /* remaining bytes of the current chunk */
+};
+
+#define MAXHEADERLINE 256   /* longer header lines are cut */
+#define MAXHEADERSIZE 16384
+
+/* response header of HTTP, RTSP and NTRIP1 servers, filled while the data
+   arrives, so it may be split over any number of recv() calls */
+struct header
+{
+  char         line[MAXHEADERLINE]; /* the line read currently */
+  int          linelen;
+  int          lines;         /* complete lines */
+  int          size;          /* bytes of the header */
+  int          done;          /* header end found */
+  int          status;        /* status code, 0 for unknown responses */
+  int          icy;           /* NTRIP1 response "ICY 200 OK" */
+  char         statusline[80];
+  int          gnssdata;      /* Content-Type: gnss/data */
+  int          sourcetable;   /* Content-Type: gnss/sourcetable */
+  int          chunked;       /* Transfer-Encoding: chunked */
+  long         contentlength; /* -1 when not given */
+  int          hassession;
+  unsigned int session;
+  int          serverport;    /* RTSP server_port, 0 when not given */
+};
+
+static void headerinit(struct header *h)
+{
+  memset(h, 0, sizeof(*h));
+  h->contentlength = -1;
+}
+
+/* compares the start of the string with a lowercase text ignoring case */
+static int headermatch(const char *s, const char *text)
+{
+  while(*text && tolower((unsigned char)*s) == *text)
+  {
+    ++s; ++text;
+  }
+  return !*text;
+}
+
+/* returns the value when the line is the named field or 0 */
+static const char *headervalue(const char *line, const char *name)
+{
+  if(!headermatch(line, name))
+    return 0;
+  line += strlen(name);
+  if(*line != ':')
+    return 0;
+  while(*(++line) == ' ' || *line == '\t')
+    ;
+  return line;
+}
+
+static void headerline(struct header *h)
+{
+  const char *l = h->line, *v;
+
+  if(!h->lines || !strncmp(l, "ICY 200 OK", 10))
+  {
+    snprintf(h->statusline, sizeof(h->statusline), "%.*s",
+    (int)sizeof(h->statusline)-1, l);
+    if(!strncmp(l, "ICY 200 OK", 10))
+    {
+      /* NTRIP1 has no proper header, the caller decides about the rest */
+      h->icy = 1;
+      h->status = 200;
+      h->done = 1;
+    }
+    else if((!strncmp(l, "HTTP/1.", 7) && l[7] && l[8] == ' ')
+    || !strncmp(l, "RTSP/1.0 ", 9))
+    {
+      h->status = atoi(l+9);
+      if(h->status < 100)
+        h->status = 0;
+    }
+    if(!h->status)
+      h->done = 1;
+  }
+  else if((v = headervalue(l, "content-type")))
+  {
+    h->gnssdata = headermatch(v, "gnss/data");
+    h->sourcetable = headermatch(v, "gnss/sourcetable");
+  }
+  else if((v = headervalue(l, "transfer-encoding")))
+    h->chunked = headermatch(v, "chunked");
+  else if((v = headervalue(l, "content-length")))
+    h->contentlength = isdigit((unsigned char)*v) ? strtol(v, 0, 10) : -1;
+  else if((v = headervalue(l, "session")))
+  {
+    h->session = strtoul(v, (char **)&v, 10);
+    h->hassession = !*v || *v == ';';
+  }
+  else if((v = headervalue(l, "transport")))
+  {
+    for(; *v && !headermatch(v, "server_port="); ++v)
+      ;
+    if(*v)
+      h->serverport = atoi(v+12);
+  }
+}
+
+/* parses header data, returns the number of bytes belonging to the header,
+   h->done is set when the header is complete */
+static int headerparse(struct header *h, const char *buf, int size)
+{
+  int i;
+
+  for(i = 0; i < size && !h->done; ++i)
+  {
+    if(buf[i] == '\n')
+    {
+      if(h->linelen && h->line[h->linelen-1] == '\r')
+        --h->linelen;
+      h->line[h->linelen] = 0;
+      if(!h->linelen && h->lines)
+        h->done = 1;
+      else
+        headerline(h);
+      ++h->lines;
+      h->linelen = 0;
+    }
+    else if(h->linelen < MAXHEADERLINE-1)
+      h->line[h->linelen++] = buf[i];
+  }
+  h->size += i;
+  return i;
+}
+
+static void headererror(const struct header *h)
+{
+  int k;
+
+  fprintf(stderr, "Could not get the requested data: ");
+  for(k = 0; h->statusline[k]; ++k)
+    fprintf(stderr, "%c", isprint((unsigned char)h->statusline[k])
+    ? h->statusline[k] : '.');
+  fprintf(stderr, "\n");
+}
+
+/* reads a complete response header from a blocking socket, returns the
+   number of bytes following the header, which are moved to the start of
+   buf, or -1 on errors */
+static int readheader(sockettype sockfd, struct header *h, char *buf, int size)
+{
+  int numbytes, i;
+
+  headerinit(h);
+  do
+  {
+    if((numbytes = recv(sockfd, buf, size, 0)) <= 0)
+    {
+      if(numbytes)
+        myperror("recv");
+      else
+        fprintf(stderr, "Connection closed.\n");
+      return -1;
+    }
+    i = headerparse(h, buf, numbytes);
+  } while(!h->done && h->size <= MAXHEADERSIZE);
+  if(!h->done)
+  {
+    fprintf(stderr, "Response header too long\n");
+    return -1;
+  }
+  memmove(buf, buf+i, numbytes-i);
+  return numbytes-i;
+}
+
+/* checks the response header of the TCP based modes and removes it from the
+   buffer, *numbytes is 0 when more header data is needed, returns 0 on
+   success, 1 on errors and 2 if trying again makes no sense */
+static int checkheader(struct header *h, char *buf, int *numbytes, int mode,
+struct chunky *c)
+{
+  int i, res = 0;
+
+  i = headerparse(h, buf, *numbytes);
+  if(!h->done)
+  {
+    *numbytes = 0;
+    if(h->size <= MAXHEADERSIZE)
+      return 0;
+    fprintf(stderr, "Response header too long\n");
+    return 1;
+  }
+  if(h->status != 200)
+  {
+    headererror(h);
+    return 1;
+  }
+  if(!h->icy && !h->gnssdata
+  && (*numbytes-i < 10 || strncmp(buf+i, "ICY 200 OK", 10)))
+  {
+    fprintf(stderr, "No 'Content-Type: gnss/data' found\n");
+    return 1;
+  }
+  if(!h->icy && h->gnssdata)
+    c->mode = h->chunked ? 1 : 0;
+  else
+  {
+    /* case 'proxy & ntrip 1.0 caster' or direct NTRIP1 answer */
+    if(mode != NTRIP1)
+    {
+      fprintf(stderr, "NTRIP version 2 HTTP connection failed%s.\n",
+      mode == AUTO ? ", falling back to NTRIP1" : "");
+      if(mode == HTTP)
+        res = 2;
+    }
+    c->mode = 0;
+    if(mode == NTRIP1)
+      i = *numbytes; /* skip old headers for NTRIP1 */
+    else
+    {
+      char *ep;
+      buf[*numbytes] = 0; /* end mark for strstr */
+      ep = strstr(buf, "\r\n\r\n");
+      i = ep ? ep+4-buf : *numbytes;
+    }
+  }
+  memmove(buf, buf+i, *numbytes-i);
+  *numbytes -= i;
+  return res;
+}
+
+/* decodes chunked transfer encoding in place, returns the number of data
+   bytes which are now at the start of buf or -1 on format errors */
+static int dechunk(struct chunky *c, char *buf, int numbytes)
+{
+  int pos = 0, out = 0, i;
+
+  while(pos < numbytes)
+  {
+    switch(c->mode)
+    {
+    case 1: /* reading number starts */
+      c->size = 0;
+      ++c->mode; /* no break */
+    case 2: /* during reading number */
+      i = buf[pos++];
+      if(i >= '0' && i <= '9') c->size = c->size*16+i-'0';
+      else if(i >= 'a' && i <= 'f') c->size = c->size*16+i-'a'+10;
+      else if(i >= 'A' && i <= 'F') c->size = c->size*16+i-'A'+10;
+      else if(i == '\r') ++c->mode;
+      else if(i == ';') c->mode = 5;
+      else return -1;
+      break;
+    case 3: /* scanning for return */
+      if(buf[pos++] == '\n') c->mode = c->size ? 4 : 1;
+      else return -1;
+      break;
+    case 4: /* output data */
+      i = numbytes-pos;
+      if(i > c->size) i = c->size;
+      memmove(buf+out, buf+pos, i);
+      out += i;
+      c->size -= i;
+      pos += i;
+      if(!c->size)
+        c->mode = 1;
+      break;
+    case 5: /* skipping chunk extension */
+      if(buf[pos++] == '\r') c->mode = 3;
+      break;
+    }
+  }
+  return out;
+}
+
+/* The sourcetable cache holds the complete sourcetable of one caster.
+   While it is younger than args->stmaxage, queries are answered from it
+   without connecting to the caster. */
+static void sourcetablecaster(const struct Args *args, char *buf, int size)
+{
+  snprintf(buf, size, "%s:%s", args->server, args->port);
+}
+
+/* prints the lines matching args->query, returns 0 on success */
+static int printsourcetable(const struct sourcetable *t,
+const struct Args *args)
+{
+  unsigned char *select = malloc(t->lines+1);
+
+  if(!select)
+  {
+    fprintf(stderr, "Could not allocate memory for the sourcetable.\n");
+    return 1;
+  }
+  if(SourcetableQuery(t, args->query, select) < 0)
+  {
+    fprintf(stderr, "Sourcetable query '%s' invalid\n", args->query);
+    free(select);
+    return 1;
+  }
+  SourcetablePrint(t, select, stdout);
+  fflush(stdout);
+  free(select);
+  return 0;
+}
+
+/* loads the cache file when it is fresh and belongs to the caster,
+   returns 1 when t was filled */
+static int loadsourcetable(const struct Args *args, struct sourcetable *t)
+{
+  char caster[256];
+  long now = time(0);
+
+  if(!args->stcache || SourcetableLoad(t, args->stcache))
+    return 0;
+  sourcetablecaster(args, caster, sizeof(caster));
+  if(!strcmp(t->caster, caster) && now >= t->fetched
+  && now < t->fetched + args->stmaxage)
+    return 1;
+  SourcetableFree(t);
+  return 0;
+}
+
+/* returns 1 when the sourcetable was printed from the cache, 2 when the
+   query failed and 0 when the sourcetable must be downloaded */
+static int cachedsourcetable(const struct Args *args)
+{
+  struct sourcetable t;
+  int res;
+
+  if(!loadsourcetable(args, &t))
+    return 0;
+  res = printsourcetable(&t, args) ? 2 : 1;
+  SourcetableFree(&t);
+  return res;
+}
+
+/* reads the complete sourcetable following the request, returns 0 on
+   success, else t is freed */
+static int readsourcetable(sockettype sockfd, const struct Args *args,
+struct sourcetable *t)
+{
+  struct header header;
+  struct chunky chunky = {0, 0};
+  char buf[MAXDATASIZE], caster[256];
+  int numbytes;
+
+  if((numbytes = readheader(sockfd, &header, buf, sizeof(buf))) < 0)
+    return 1;
+  if((header.status != 200 || header.icy)
+  && strncmp(header.statusline, "SOURCETABLE 200 OK", 18))
+  {
+    headererror(&header);
+    return 1;
+  }
+  /* the header lines of NTRIP1 casters are skipped with the other lines
+     which are no sourcetable records */
+  chunky.mode = header.chunked;
+  sourcetablecaster(args, caster, sizeof(caster));
+  SourcetableInit(t, caster, time(0));
+  do
+  {
+    if(chunky.mode && (numbytes = dechunk(&chunky, buf, numbytes)) < 0)
+    {
+      fprintf(stderr, "Error in chunky transfer encoding\n");
+      break;
+    }
+    if(!SourcetableAdd(t, buf, numbytes))
+    {
+      fprintf(stderr, "Could not allocate memory for the sourcetable.\n");
+      numbytes = -1;
+      break;
+    }
+  } while(!t->complete && (numbytes = recv(sockfd, buf, sizeof(buf), 0)) > 0);
+  if(!t->complete)
+  {
+    if(numbytes >= 0)
+      fprintf(stderr, "Sourcetable incomplete\n");
+  }
+  else if(!SourcetableFinish(t))
+    fprintf(stderr, "Could not allocate memory for the sourcetable.\n");
+  else
+    return 0;
+  SourcetableFree(t);
+  return 1;
+}
+
+/* reads the complete sourcetable, stores it in the cache file and prints
+   the lines matching the query, returns 0 on success */
+static int fetchsourcetable(sockettype sockfd, const struct Args *args)
+{
+  struct sourcetable t;
+  const char *e;
+  int res;
+
+  if(readsourcetable(sockfd, args, &t))
+    return 1;
+  if((e = SourcetableSave(&t, args->stcache)))
+    fprintf(stderr, "%s\n", e);
+  res = printsourcetable(&t, args);
+  SourcetableFree(&t);
+  return res;
+}
+
+/* Nearest mountpoint selection: the STR records matching the query are
+   indexed by position and the stream nearest to the rover is requested.
+   The sourcetable is downloaded again when it is older than
+   args->stmaxage. */
+struct nearest
+{
+  struct sourcetable table;
+  struct stindex     index;
+  int                loaded;
+  char               mountpoint[256];
+  int                line;       /* record of the mountpoint */
+};
+
+/* downloads the sourcetable over a separate connection, returns 0 on
+   success */
+static int downloadsourcetable(struct Args *args, struct sourcetable *t)
+{
+  struct address addresses;
+  struct sockaddr_storage addr;
+  socklen_t len;
+  const char *proxyserver, *data = args->data;
+  char proxyport[6], buf[MAXDATASIZE];
+  sockettype sockfd;
+  int i, res = 1;
+
+  if(getaddress(args, SOCK_STREAM, &addresses, &proxyserver, proxyport,
+  sizeof(proxyport), 1))
+    return 1;
+  if((sockfd = connectrace(&addresses, &addr, &len, args->bitrate, -1)) == -1)
+  {
+    forgetaddress(args, SOCK_STREAM);
+    return 1;
+  }
+  args->data = 0;
+  i = buildrequest(buf, sizeof(buf), args, proxyserver, proxyport);
+  args->data = data;
+  if(i >= 0)
+  {
+    if(send(sockfd, buf, (size_t)i, 0) != i)
+      myperror("send");
+    else
+      res = readsourcetable(sockfd, args, t);
+  }
+  closesocket(sockfd);
+  return res;
+}
+
+/* loads the sourcetable and indexes the suitable streams, returns 0 on
+   success, 1 on errors which may vanish later and 2 for a bad query */
+static int nearestload(struct Args *args, struct nearest *n)
+{
+  unsigned char *select;
+  const char *e;
+  int r;
+
+  if(n->loaded)
+  {
+    SourcetableIndexFree(&n->index);
+    SourcetableFree(&n->table);
+    n->loaded = 0;
+  }
+  if(!loadsourcetable(args, &n->table))
+  {
+    if(downloadsourcetable(args, &n->table))
+      return 1;
+    if(args->stcache && (e = SourcetableSave(&n->table, args->stcache)))
+      fprintf(stderr, "%s\n", e);
+  }
+  if(!(select = malloc(n->table.lines+1)))
+  {
+    SourcetableFree(&n->table);
+    return 1;
+  }
+  if(SourcetableQuery(&n->table, args->query, select) < 0)
+  {
+    fprintf(stderr, "Sourcetable query '%s' invalid\n", args->query);
+    free(select);
+    SourcetableFree(&n->table);
+    return 2;
+  }
+  /* only RTCM3 streams when frames are checked */
+  for(r = 0; r < n->table.lines && args->frames; ++r)
+  {
+    if(!SourcetableWildcard("RTCM 3*", SourcetableCell(&n->table, 3, r)))
+      select[r] = 0;
+  }
+  r = SourcetableIndex(&n->index, &n->table, select);
+  free(select);
+  if(!r)
+  {
+    SourcetableFree(&n->table);
+    return 1;
+  }
+  n->loaded = 1;
+  return 0;
+}
+
+/* sets args->data to the stream nearest to the position, returns like
+   nearestload() */
+static int nearestmountpoint(struct Args *args, struct nearest *n,
+double lat, double lon)
+{
+  int line[SOURCETABLEMAXNEAR], num, i;
+  double km[SOURCETABLEMAXNEAR];
+
+  if((!n->loaded || time(0) >= n->table.fetched + args->stmaxage
+  || time(0) < n->table.fetched) && (i = nearestload(args, n)))
+    return i;
+  if(!(num = SourcetableNearest(&n->index, lat, lon, args->nearest, line,
+  km)))
+  {
+    fprintf(stderr, "No suitable stream found in the sourcetable\n");
+    return 2;
+  }
+  if(strcmp(n->mountpoint, SourcetableCell(&n->table, 1, line[0])))
+  {
+    fprintf(stderr, "Nearest streams to %.5f %.5f:\n", lat, lon);
+    for(i = 0; i < num; ++i)
+      fprintf(stderr, "  %-20s %8.1f km\n",
+      SourcetableCell(&n->table, 1, line[i]), km[i]);
+    snprintf(n->mountpoint, sizeof(n->mountpoint), "%s",
+    SourcetableCell(&n->table, 1, line[0]));
+  }
+  n->line = line[0];
+  args->data = n->mountpoint;
+  return 0;
+}
+
+static void nearestfree(struct nearest *n)
+{
+  if(n->loaded)
+  {
+    SourcetableIndexFree(&n->index);
+    SourcetableFree(&n->table);
+  }
+  n->loaded = 0;
+}
+
+#ifdef HAVE_MERGE
+/* The second path of a merged stream is received by a thread, the frames
+   of both paths pass the merge stage while the output is locked, so each
+   frame is output once when its first copy arrives. */
+#define MERGETIMEOUT 30 /* seconds without data until a reconnect */
+
+struct mergestream
+{
+  struct Args     args;
+  char            urlbuf[1000]; /* strings of args */
+  pthread_t       thread;
+  pthread_mutex_t mutex;        /* held while the output is written */
+  struct merge    merge;
+  struct rtcm3    rtcm3;        /* frames of the second path */
+  struct output  *out;
+  sockettype      sockfd;       /* -1 while not connected */
+  int             wake[2];      /* pipe readable after mergestop() */
+  atomic_int      running;
+};
+#endif
+
+struct output
+{
+  struct serial *serial; /* serial device, file output is used when 0 */
+  FILE          *file;
+  struct rtcm3  *rtcm3;  /* RTCM3 frame filter or 0 */
+#ifdef HAVE_SERIALQUEUE
+  struct serialqueue *queue; /* serial writer thread or 0 */
+#endif
+  struct fanout *fanout; /* local clients or 0 */
+  struct metrics *metrics; /* counters or 0 */
+  struct rtcm3age *age;  /* correction ages of the frames or 0 */
+  double         arrival; /* UTC ms of the last recv() */
+  double         agepublished;
+  int            cutepoch; /* stop the output after the end of an epoch */
+  int            epochend; /* the output was stopped */
+#ifdef HAVE_MERGE
+  struct mergestream *merge; /* second path or 0 */
+#endif
+  double         batchwait; /* ms file output waits at most, 0 unbuffered */
+  double         pending;  /* ms of the oldest data not written, 0 if none */
+  int            epochopen; /* more messages of the epoch follow */
+  struct rtcm3epoch *epoch; /* epoch assembler or 0 */
+  double         epochwait; /* ms an incomplete epoch is held at most */
+  double         epochheld; /* ms when its first message was held */
+  double         ratestart; /* ms, start of the serial rate measurement */
+  double         ratebytes;
+  int            ratewarned;
+};
+
+/* compares the data rate of the stream with what the serial device can
+   carry and warns once when it is too slow */
+#define SERIALRATEPERIOD 10000 /* ms */
+static void serialrate(struct output *out, int size)
+{
+  double now = mstime();
+
+  if(!out->ratestart)
+    out->ratestart = now;
+  out->ratebytes += size;
+  if(now - out->ratestart >= SERIALRATEPERIOD)
+  {
+    double rate = out->ratebytes*1000/(now - out->ratestart);
+    double capacity = 1000/out->serial->CharTime;
+    if(rate > capacity && !out->ratewarned)
+    {
+      fprintf(stderr, "Warning: The stream needs %.0f bytes/s, the serial "
+      "device carries %.0f bytes/s.\n", rate, capacity);
+      out->ratewarned = 1;
+    }
+    out->ratestart = now;
+    out->ratebytes = 0;
+  }
+}
+
+static int writedata(struct output *out, const char *buf, int size)
+{
+#ifdef HAVE_FANOUT
+  if(out->fanout)
+    FanoutWrite(out->fanout, buf, size);
+#endif
+  if(out->serial)
+    serialrate(out, size);
+#ifdef HAVE_SERIALQUEUE
+  if(out->queue)
+  {
+    int res = SerialQueueWrite(out->queue, buf, size);
+    MetricsBacklog(out->metrics, SerialQueueUsed(out->queue));
+    return res;
+  }
+#endif
+  if(out->serial)
+  {
+    int ofs = 0;
+    while(size > ofs && !stop)
+    {
+      int i = SerialWrite(out->serial, buf+ofs, size-ofs);
+      if(i < 0)
+        return -1;
+      ofs += i;
+    }
+  }
+  else
+  {
+    fwrite(buf, (size_t)size, 1, out->file);
+    if(out->batchwait && !out->pending)
+      out->pending = mstime();
+  }
+  return 0;
+}
+
+/* writes the data gathered in the buffer of the output file */
+static void flushdata(struct output *out)
+{
+  if(out->pending)
+  {
+    fflush(out->file);
+    out->pending = 0;
+  }
+}
+
+/* writes the messages of the held epoch */
+static int writeepoch(struct output *out)
+{
+  int res = writedata(out, (const char *)out->epoch->buf, out->epoch->size);
+  MetricsEpoch(out->metrics, out->epoch);
+  Rtcm3EpochClear(out->epoch);
+  return res;
+}
+
+/* writes the frames which r finds in the data received over the given
+   path at the UTC time arrival in ms, returns -1 when the serial device
+   failed */
+static int outputframes(struct output *out, struct rtcm3 *r, int path,
+double arrival, const char *buf, int size)
+{
+  const unsigned char *frame;
+  const char *run = 0;
+  int n, runsize = 0;
+
+  if(out->age && arrival - out->agepublished >= 1000)
+  {
+    MetricsAge(out->metrics, out->age);
+    out->agepublished = arrival;
+  }
+  if(out->epoch && out->epoch->size
+  && mstime() >= out->epochheld + out->epochwait && writeepoch(out) < 0)
+    return -1;
+  /* frames following each other in the input are written at once */
+  while((n = Rtcm3Next(r, &buf, &size, &frame)))
+  {
+    int end;
+#ifdef HAVE_MERGE
+    if(out->merge && !MergeFrame(&out->merge->merge, path, frame, n, mstime()))
+      continue;
+#endif
+#ifdef HAVE_FANOUT
+    if(out->fanout)
+      FanoutFrame(out->fanout, frame, n);
+#endif
+    if(out->age)
+      Rtcm3Age(out->age, frame, n, arrival);
+    if(out->epochend)
+      continue;
+    end = Rtcm3EpochEnd(frame, n);
+    if(out->cutepoch && end == 1)
+      out->epochend = 1;
+    /* other messages may come between those of an epoch */
+    if(end >= 0)
+      out->epochopen = !end && !out->epoch;
+    if(out->epoch && (end >= 0 || out->epoch->size))
+    {
+      /* the epoch is written when its last message arrived */
+      if((run && writedata(out, run, runsize) < 0)
+      || (Rtcm3EpochFull(out->epoch, n) && writeepoch(out) < 0))
+        return -1;
+      run = 0;
+      if(!out->epoch->size)
+        out->epochheld = mstime();
+      if(Rtcm3EpochPut(out->epoch, frame, n, end, arrival))
+      {
+        if(writeepoch(out) < 0)
+          return -1;
+        flushdata(out);
+      }
+      continue;
+    }
+    if(frame >= r->buf && frame < r->buf+RTCM3MAXFRAME)
+    {
+      /* the internal buffer is reused by the next call */
+      if((run && writedata(out, run, runsize) < 0)
+      || writedata(out, (const char *)frame, n) < 0)
+        return -1;
+      run = 0;
+    }
+#ifdef HAVE_SERIALQUEUE
+    /* the queue drops complete frames when it is full */
+    else if(run && (const char *)frame == run+runsize && !out->queue)
+#else
+    else if(run && (const char *)frame == run+runsize)
+#endif
+      runsize += n;
+    else
+    {
+      if(run && writedata(out, run, runsize) < 0)
+        return -1;
+      run = (const char *)frame;
+      runsize = n;
+    }
+    if(end == 1 && out->batchwait)
+    {
+      /* a complete epoch is written at once */
+      if(run && writedata(out, run, runsize) < 0)
+        return -1;
+      run = 0;
+      flushdata(out);
+    }
+  }
+  return run ? writedata(out, run, runsize) : 0;
+}
+
+/* writes the received data, returns -1 when the serial device failed */
+static int outputdata(struct output *out, const char *buf, int size)
+{
+#ifdef HAVE_MERGE
+  int res;
+#endif
+
+  if(!out->rtcm3)
+    return writedata(out, buf, size);
+#ifdef HAVE_MERGE
+  if(out->merge)
+  {
+    pthread_mutex_lock(&out->merge->mutex);
+    res = outputframes(out, out->rtcm3, 0, out->arrival, buf, size);
+    pthread_mutex_unlock(&out->merge->mutex);
+    return res;
+  }
+#endif
+  return outputframes(out, out->rtcm3, 0, out->arrival, buf, size);
+}
+
+/* writes the gathered output, the lock of the merge stage is taken */
+static void outputflush(struct output *out)
+{
+#ifdef HAVE_MERGE
+  if(out->merge)
+  {
+    pthread_mutex_lock(&out->merge->mutex);
+    flushdata(out);
+    pthread_mutex_unlock(&out->merge->mutex);
+    return;
+  }
+#endif
+  flushdata(out);
+}
+
+/* the received data was written and the socket had no more, the output
+   is flushed unless an epoch is incomplete */
+static void outputdrained(struct output *out)
+{
+  if(!out->epochopen)
+    outputflush(out);
+}
+
+/* waits until sockfd has data, but when output is gathered or an epoch
+   is held at most until it has to be written, drained tells that the
+   last read emptied the socket, otherwise more data is expected at once */
+static void outputwait(struct output *out, sockettype sockfd, int drained)
+{
+  double wait, deadline = 0;
+  fd_set fdr;
+  struct timeval tv;
+
+#ifdef HAVE_MERGE
+  if(out->merge)
+    pthread_mutex_lock(&out->merge->mutex);
+#endif
+  if(out->pending)
+    deadline = out->pending + out->batchwait;
+  if(out->epoch && out->epoch->size
+  && (!deadline || out->epochheld + out->epochwait < deadline))
+    deadline = out->epochheld + out->epochwait;
+#ifdef HAVE_MERGE
+  if(out->merge)
+    pthread_mutex_unlock(&out->merge->mutex);
+#endif
+  if(!deadline)
+    return;
+  if((wait = deadline - mstime()) > 0)
+  {
+    if(!drained)
+      return;
+    FD_ZERO(&fdr);
+    FD_SET(sockfd, &fdr);
+    tv.tv_sec = wait/1000;
+    tv.tv_usec = (long)(wait*1000) % 1000000;
+    if(select(sockfd+1, &fdr, 0, 0, &tv) > 0)
+      return;
+  }
+#ifdef HAVE_MERGE
+  if(out->merge)
+    pthread_mutex_lock(&out->merge->mutex);
+#endif
+  /* an incomplete epoch is given up */
+  if(out->epoch && out->epoch->size
+  && mstime() >= out->epochheld + out->epochwait)
+    writeepoch(out);
+  flushdata(out);
+#ifdef HAVE_MERGE
+  if(out->merge)
+    pthread_mutex_unlock(&out->merge->mutex);
+#endif
+}
+
+#ifdef HAVE_MERGE
+/* waits up to ms, returns 1 when the second path is stopped */
+static int mergewait(struct mergestream *m, int ms)
+{
+  struct pollfd pfd = {m->wake[0], POLLIN, 0};
+  return !m->running || stop || poll(&pfd, 1, ms) > 0;
+}
+
+/* receives the second path until the program ends, reconnecting like the
+   main connection */
+static void *mergethread(void *data)
+{
+  struct mergestream *m = data;
+  struct reconnect reconnect;
+  char buf[MAXDATASIZE];
+
+  memset(&reconnect, 0, sizeof(reconnect));
+  while(m->running && !stop)
+  {
+    struct address addresses;
+    struct sockaddr_storage addr;
+    struct timeval tv = {MERGETIMEOUT, 0};
+    struct header header;
+    struct chunky chunky = {0, 0};
+    socklen_t len;
+    const char *proxyserver;
+    char proxyport[6];
+    sockettype sockfd;
+    int numbytes, res = 0;
+
+    if(mergewait(m, (int)reconnectdelay(&reconnect)))
+      break;
+    /* the name is looked up in the background and the connect gives up
+       when woken, so mergestop() does not wait for either */
+    while((res = getaddress(&m->args, SOCK_STREAM, &addresses, &proxyserver,
+    proxyport, sizeof(proxyport), 0)) == -1 && !mergewait(m, 100))
+      ;
+    if(res == -1)
+      break;
+    if(res || (sockfd = connectrace(&addresses, &addr, &len, m->args.bitrate,
+    m->wake[0])) == -1)
+    {
+      forgetaddress(&m->args, SOCK_STREAM);
+      reconnectlost(&reconnect);
+      continue;
+    }
+    pthread_mutex_lock(&m->mutex);
+    m->sockfd = sockfd;
+    pthread_mutex_unlock(&m->mutex);
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    headerinit(&header);
+    Rtcm3Reset(&m->rtcm3);
+    if((numbytes = buildrequest(buf, sizeof(buf), &m->args, proxyserver,
+    proxyport)) < 0 || send(sockfd, buf, (size_t)numbytes, 0) != numbytes)
+      res = -1;
+    while(!res && m->running && (numbytes = recv(sockfd, buf,
+    sizeof(buf)-1, 0)) > 0)
+    {
+      int drained = numbytes < (int)sizeof(buf)-1;
+
+      if(!header.done)
+      {
+        /* an error reply is not data, 2 ends this path */
+        if((res = checkheader(&header, buf, &numbytes, m->args.mode,
+        &chunky)))
+          break;
+        if(!numbytes)
+          continue;
+      }
+      reconnectdata(&reconnect);
+      if(chunky.mode && (numbytes = dechunk(&chunky, buf, numbytes)) < 0)
+        break;
+      pthread_mutex_lock(&m->mutex);
+      if((res = outputframes(m->out, &m->rtcm3, 1, utctime(), buf,
+      numbytes)) >= 0 && drained && !m->out->epochopen)
+        flushdata(m->out);
+      pthread_mutex_unlock(&m->mutex);
+    }
+    pthread_mutex_lock(&m->mutex);
+    m->sockfd = -1;
+    closesocket(sockfd);
+    pthread_mutex_unlock(&m->mutex);
+    reconnectlost(&reconnect);
+    if(res == 2)
+    {
+      fprintf(stderr, "Second path %s given up.\n", m->args.data);
+      break;
+    }
+    if(m->running && m->args.bitrate)
+      fprintf(stderr, "Second path %s lost.\n", m->args.data);
+  }
+  return 0;
+}
+
+/* starts the reception of the second path, returns 0 or an error message */
+static const char *mergestart(struct mergestream *m, const struct Args *args,
+struct output *out)
+{
+  const char *err;
+  char *bufpos = m->urlbuf;
+
+  m->args = *args;
+  m->args.data = 0;
+  if((err = parseurl(args->merge, &m->args, &bufpos,
+  m->urlbuf+sizeof(m->urlbuf))))
+    return err;
+  if(!m->args.data || *m->args.data == '%')
+    return "The second path needs a mountpoint.";
+  if(m->args.mode == RTSP || m->args.mode == UDP)
+    m->args.mode = AUTO;
+  MergeInit(&m->merge);
+  memset(&m->rtcm3, 0, sizeof(m->rtcm3));
+  m->out = out;
+  m->sockfd = -1;
+  m->running = 1;
+  if(pipe(m->wake))
+    return "Could not create pipe.";
+  pthread_mutex_init(&m->mutex, 0);
+  out->merge = m;
+  if(pthread_create(&m->thread, 0, mergethread, m))
+  {
+    out->merge = 0;
+    close(m->wake[0]);
+    close(m->wake[1]);
+    return "Could not start the second path.";
+  }
+  return 0;
+}
+
+static void mergestop(struct mergestream *m)
+{
+  pthread_mutex_lock(&m->mutex);
+  m->running = 0;
+  if(m->sockfd != -1)
+    shutdown(m->sockfd, SHUT_RDWR);
+  pthread_mutex_unlock(&m->mutex);
+  if(write(m->wake[1], "", 1) < 0)
+    pthread_cancel(m->thread);
+  pthread_join(m->thread, 0);
+  close(m->wake[0]);
+  close(m->wake[1]);
+  m->out->merge = 0;
+}
+#endif /* HAVE_MERGE */
+
+#define RTPBATCH      16   /* datagrams received with one call */
+#define RTPPACKETSIZE 1526
+
+struct rtpbatch
+{
+  char           buf[RTPBATCH][RTPPACKETSIZE];
+  int            len[RTPBATCH];
+#ifdef HAVE_RECVMMSG
+  struct mmsghdr msg[RTPBATCH];
+  struct iovec   iov[RTPBATCH];
+#endif
+};
+
+/* receives the waiting datagrams, returns their number, 0 when none is
+   waiting or -1 on errors */
+static int rtpreceive(sockettype sock, struct rtpbatch *b)
+{
+#ifdef HAVE_RECVMMSG
+  int i, num;
+
+  for(i = 0; i < RTPBATCH; ++i)
+  {
+    b->iov[i].iov_base = b->buf[i];
+    b->iov[i].iov_len = RTPPACKETSIZE;
+    memset(&b->msg[i].msg_hdr, 0, sizeof(b->msg[i].msg_hdr));
+    b->msg[i].msg_hdr.msg_iov = &b->iov[i];
+    b->msg[i].msg_hdr.msg_iovlen = 1;
+  }
+  if((num = recvmmsg(sock, b->msg, RTPBATCH, MSG_DONTWAIT, 0)) < 0)
+    return WOULDBLOCK(errno) ? 0 : -1;
+  for(i = 0; i < num; ++i)
+    b->len[i] = b->msg[i].msg_len;
+  return num;
+#else
+  if((b->len[0] = recv(sock, b->buf[0], RTPPACKETSIZE, 0)) < 0)
+    return WOULDBLOCK(socketerror()) ? 0 : -1;
+  return 1;
+#endif
+}
+
+/* checks the fixed RTP header, returns the payload type including the
+   marker bit or -1 for invalid packets */
+static int rtpheader(const char *p, int size, int *seq, unsigned int *session)
+{
+  *seq = 0;
+  *session = 0;
+  if(size < 12 || (unsigned char)p[0] != (2 << 6))
+    return -1;
+  *seq = ((unsigned char)p[2]<<8)+(unsigned char)p[3];
+  *session = ((unsigned int)(unsigned char)p[8]<<24)
+  +((unsigned char)p[9]<<16)+((unsigned char)p[10]<<8)+(unsigned char)p[11];
+  return (unsigned char)p[1];
+}
+
+#ifndef WINDOWSVERSION
+/* writes all data of the vector, returns -1 on errors */
+static int writeall(int fd, struct iovec *iov, int num)
+{
+  while(num)
+  {
+    ssize_t i = writev(fd, iov, num);
+    if(i < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      return -1;
+    }
+    for(; num && (size_t)i >= iov->iov_len; --num, ++iov)
+      i -= iov->iov_len;
+    if(num)
+    {
+      iov->iov_base = (char *)iov->iov_base + i;
+      iov->iov_len -= i;
+    }
+  }
+  return 0;
+}
+#endif
+
+/* outputs the RTP packets which are ready, returns -1 on output errors */
+static int rtpoutput(struct rtpbuffer *b, struct output *out, int flush,
+struct reconnect *r, int verbose)
+{
+  const char *data;
+  int size;
+
+#ifndef WINDOWSVERSION
+  if(!out->serial && !out->rtcm3 && !out->fanout)
+  {
+    /* plain output gathers the released packets into one write, a pending
+       packet moving into the window may reuse a released slot */
+    struct iovec iov[RTPSLOTS];
+    int num;
+    do
+    {
+      for(num = 0; num < RTPSLOTS && (!num || !b->pending.used)
+      && (size = RtpNext(b, mstime(), flush, &data)) > 0; ++num)
+      {
+        iov[num].iov_base = (void *)data;
+        iov[num].iov_len = size;
+      }
+      if(num && reconnectdata(r) > 0 && verbose)
+        reconnectstats(0, r);
+      if(num && writeall(fileno(out->file), iov, num) < 0)
+        return -1;
+    } while(num);
+    return 0;
+  }
+#endif
+  while((size = RtpNext(b, mstime(), flush, &data)) > 0)
+  {
+    if(reconnectdata(r) > 0 && verbose)
+      reconnectstats(0, r);
+    if(outputdata(out, data, size) < 0)
+      return -1;
+  }
+  outputflush(out);
+  return 0;
+}
+
+/* stores a received packet, while a packet beyond the window is pending
+   the packets before it are output, returns -1 on output errors */
+static int rtpput(struct rtpbuffer *b, struct output *out, int seq,
+const char *data, int size, struct reconnect *r, int verbose)
+{
+  RtpPut(b, seq, data, size, mstime());
+  return b->pending.used ? rtpoutput(b, out, 0, r, verbose) : 0;
+}
+
+#ifdef HAVE_FANOUT
+static void fanoutstats(struct fanout *f)
+{
+  pthread_mutex_lock(&f->mutex);
+  fprintf(stderr, "Local clients: %d connected, %lu accepted, %lu dropped.\n",
+  f->clients, f->accepted, f->dropped);
+  pthread_mutex_unlock(&f->mutex);
+}
+#endif
+
+static void agestats(const struct rtcm3age *a)
+{
+  static const double q[4] = {0.5, 0.9, 0.99, 1};
+  long p[4];
+  int i;
+
+  for(i = 0; i < a->types; ++i)
+  {
+    Rtcm3AgePercentiles(&a->t[i], q, p, 4);
+    fprintf(stderr, "Age of %d: %ld/%ld/%ld ms (50/90/99%%), max %ld ms, "
+    "%lu messages.\n", a->t[i].type, p[0], p[1], p[2], p[3], a->t[i].count);
+  }
+}
+
+static void epochstats(const struct rtcm3epoch *e)
+{
+  fprintf(stderr, "Epochs: %lu complete, %lu incomplete, last message "
+  "after %.1f ms mean, %.1f ms max, complete %.1f ms mean, %ld ms max after "
+  "the epoch.\n", e->complete, e->incomplete, e->complete ? e->assembly
+  / e->complete : 0.0, e->maxassembly, e->complete ? e->completionsum
+  / e->complete : 0.0, e->maxcompletion);
+}
+
+/* prints the correction ages, the epoch assembly and the results of the
+   merge stage */
+static void outputstats(struct output *out)
+{
+#ifdef HAVE_MERGE
+  if(out->merge)
+  {
+    struct merge *m = &out->merge->merge;
+    int i;
+
+    pthread_mutex_lock(&out->merge->mutex);
+    for(i = 0; i < MERGEPATHS; ++i)
+    {
+      const struct mergepath *p = &m->path[i];
+      unsigned long first = m->path[0].first + m->path[1].first;
+      fprintf(stderr, "Path %d: %lu frames, %.1f%% first, %lu copies later "
+      "by %.1f ms mean, %.1f ms max.\n", i+1, p->frames, first ? 100.0
+      * p->first / first : 0.0, p->late, p->late ? p->lag / p->late : 0.0,
+      p->maxlag);
+    }
+    if(out->age)
+      agestats(out->age);
+    if(out->epoch)
+      epochstats(out->epoch);
+    pthread_mutex_unlock(&out->merge->mutex);
+    return;
+  }
+#endif
+  if(out->age)
+    agestats(out->age);
+  if(out->epoch)
+    epochstats(out->epoch);
+}
+
+static void rtpstats(const struct rtpbuffer *b)
+{
+  fprintf(stderr, "RTP: %lu packets, %lu reordered, %lu lost, %lu late, "
+  "%lu duplicates.\n", b->received, b->reordered, b->lost, b->late,
+  b->duplicates);
+}
+
+/* select() timeout, short enough to output held RTP packets in time */
+static void rtptimeout(const struct rtpbuffer *b, struct timeval *tv)
+{
+  double wait = RtpWait(b, mstime());
+
+  tv->tv_sec = 1;
+  tv->tv_usec = 0;
+  if(wait >= 0 && wait < 1000)
+  {
+    tv->tv_sec = 0;
+    tv->tv_usec = wait*1000;
+  }
+}
+
+/* NMEA sentences of the serial device: a sentence starts with '$', is
+   recognized by the formatter behind the two character talker ID, so
+   $GPGGA, $GNGGA and $GLGGA are all the same, and ends with the checksum.
+   Sentences with a wrong or without checksum are dropped. GGA sentences
+   are sent to the caster at most once in the period given with '-g',
+   unless the position moved farther than given with '-j'. */
+#define NMEAMAXLEN 200
+#define NMEASLACK  0.1  /* share of the period a sentence may come early */
+
+struct nmea
+{
+  char   buffer[NMEAMAXLEN];
+  size_t bufpos;           /* 0 while waiting for '$' */
+  size_t starpos;
+  struct metrics *metrics; /* counters or 0 */
+  double period;           /* ms between GGA sentences sent to the caster */
+  double move;             /* km after which one is sent at once, 0 off */
+  double next;             /* ms, when the next one is due */
+  int    position;         /* a GGA sentence with a fix was read */
+  double lat;              /* degrees of the last fix */
+  double lon;
+  unsigned long fixes;     /* GGA sentences with a fix */
+  unsigned long sent;      /* of them sent to the caster */
+  double sentlat;          /* degrees of the last one sent */
+  double sentlon;
+  char   gga[NMEAMAXLEN];  /* the last one sent */
+  size_t ggalen;
+};
+
+/* reads the position of a GGA sentence, returns 1 when it has a fix */
+static int ggaposition(const char *s, double *lat, double *lon)
+{
+  const char *f[7];
+  double v;
+  int i;
+
+  if(strlen(s) < 7 || s[0] != '$' || strncmp(s+3, "GGA,", 4))
+    return 0;
+  for(i = 0; i < 7 && (s = strchr(s, ',')); ++i)
+    f[i] = ++s;
+  if(i < 7 || *f[1] == ',' || *f[3] == ',' || atoi(f[5]) <= 0)
+    return 0;
+  v = strtod(f[1], 0);
+  *lat = (int)(v/100) + (v - (int)(v/100)*100)/60;
+  if(*f[2] == 'S')
+    *lat = -*lat;
+  v = strtod(f[3], 0);
+  *lon = (int)(v/100) + (v - (int)(v/100)*100)/60;
+  if(*f[4] == 'W')
+    *lon = -*lon;
+  return 1;
+}
+
+/* sends the GGA sentence in the buffer to the caster when it is due,
+   returns like readnmea() */
+static int nmeagga(struct nmea *n, sockettype sockfd)
+{
+  double now = mstime(), lat, lon;
+  int fix = ggaposition(n->buffer, &lat, &lon), moved = 0;
+
+  if(fix)
+  {
+    n->position = 1;
+    n->lat = lat;
+    n->lon = lon;
+    ++n->fixes;
+    moved = n->move && n->sent
+    && SourcetableKm(n->sentlat, n->sentlon, lat, lon) > n->move;
+  }
+  if(!moved && now < n->next - n->period*NMEASLACK)
+    return 0;
+  /* the sentences keep the pace of the period despite jitter */
+  if(!moved && now - n->next < n->period)
+    n->next += n->period;
+  else
+    n->next = now + n->period;
+  if(fix)
+  {
+    ++n->sent;
+    n->sentlat = lat;
+    n->sentlon = lon;
+    memcpy(n->gga, n->buffer, n->bufpos);
+    n->ggalen = n->bufpos;
+  }
+  if(sockfd)
+  {
+    if(send(sockfd, n->buffer, n->bufpos, 0) != (int)n->bufpos)
+    {
+      fprintf(stderr, "Could not send NMEA\n");
+      return 1;
+    }
+    MetricsNmea(n->metrics);
+  }
+  return 0;
+}
+
+/* the sentences which are used */
+static const struct nmeasentence
+{
+  const char *formatter;
+  int (*handle)(struct nmea *n, sockettype sockfd);
+} nmeasentences[] = {
+{ "GGA", nmeagga },
+{0,0}};
+
+/* checks the complete sentence in the buffer and handles it, returns
+   like readnmea() */
+static int nmeasentence(struct nmea *n, sockettype sockfd)
+{
+  const struct nmeasentence *s;
+  unsigned int sum = 0, check;
+  size_t i;
+
+  for(i = 1; i < n->starpos; ++i)
+    sum ^= (unsigned char)n->buffer[i];
+  n->buffer[n->bufpos] = 0;
+  if(sscanf(n->buffer+n->starpos+1, "%2x", &check) != 1 || check != sum)
+  {
+    MetricsNmeaError(n->metrics);
+    return 0;
+  }
+  n->buffer[n->bufpos++] = '\r';
+  n->buffer[n->bufpos++] = '\n';
+  n->buffer[n->bufpos] = 0;
+  if(n->starpos < 7 || n->buffer[6] != ',')
+    return 0;
+  for(s = nmeasentences; s->formatter; ++s)
+  {
+    if(!strncmp(n->buffer+3, s->formatter, 3))
+      return s->handle(n, sockfd);
+  }
+  return 0;
+}
+
+/* reads the serial device, copies the data to stdout and the logfile and
+   sends GGA sentences to the caster when sockfd is set, returns 0 on
+   success, 1 when sending failed and 2 when the serial device failed */
+static int readnmea(struct serial *sx, struct nmea *n, sockettype sockfd,
+FILE *ser)
+{
+  char buf[200];
+  int doloop = 1;
+
+  while(doloop && !stop)
+  {
+    int i = SerialRead(sx, buf, sizeof(buf));
+    if(i < 0)
+    {
+      fprintf(stderr, "Could not access serial device\n");
+      return 2;
+    }
+    else
+    {
+      int j;
+      if(i < (int)sizeof(buf)) doloop = 0;
+      fwrite(buf, i, 1, stdout);
+      if(ser)
+        fwrite(buf, i, 1, ser);
+      for(j = 0; j < i; ++j)
+      {
+        if(buf[j] == '$')
+        {
+          n->buffer[0] = '$';
+          n->bufpos = 1;
+          n->starpos = 0;
+        }
+        else if(!n->bufpos)
+          continue;
+        else if(buf[j] == '\r' || buf[j] == '\n'
+        || n->bufpos >= sizeof(n->buffer)-3)
+        {
+          /* without checksum or too long */
+          MetricsNmeaError(n->metrics);
+          n->bufpos = 0;
+        }
+        else
+        {
+          if(buf[j] == '*' && !n->starpos)
+            n->starpos = n->bufpos;
+          n->buffer[n->bufpos++] = buf[j];
+          if(n->starpos && n->bufpos == n->starpos + 3)
+          {
+            int res = nmeasentence(n, sockfd);
+            n->bufpos = 0;
+            doloop = 0;
+            if(res)
+              return res;
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+/* waits until network data arrives, NMEA sentences from the serial device
+   are forwarded as soon as they are complete, returns like readnmea() */
+static int waitsocket(sockettype sockfd, struct serial *sx, struct nmea *n,
+FILE *ser)
+{
+#ifdef WINDOWSVERSION
+  /* serial devices cannot be waited for together with sockets */
+  return readnmea(sx, n, sockfd, ser);
+#else
+  while(!stop)
+  {
+    struct pollfd p[2];
+    int i;
+
+    p[0].fd = sockfd;
+    p[0].events = POLLIN;
+    p[1].fd = sx->Stream;
+    p[1].events = POLLIN;
+    p[0].revents = p[1].revents = 0;
+    if(poll(p, 2, -1) < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      myperror("poll");
+      return 1;
+    }
+    if(p[1].revents && (i = readnmea(sx, n, sockfd, ser)))
+      return i;
+    if(p[0].revents)
+      break;
+  }
+  return 0;
+#endif
+}
+
+#ifdef HAVE_HANDOVER
+/* Make-before-break handover: a thread connects to the new stream and
+   reads its response header while the old stream is output. Then the
+   data of the new stream is held from the end of an epoch on until the
+   next epoch is complete. The old stream is output until its current
+   epoch ended, then the held data follows, so the output sees neither a
+   gap nor a torn frame.
+   A standby stream is connected the same way, but keeps only the data
+   of its current epoch and is used as soon as the old stream stalls. */
+#define HANDOVERMARGIN  2.0    /* km the new stream must be nearer */
+#define HANDOVERWAIT    2000   /* ms waited for the end of the old epoch */
+#define HANDOVERRETRY   10000  /* ms after a failed handover */
+#define HANDOVERTIMEOUT 10     /* seconds for the response header */
+#define HANDOVERHELD    65536
+#define STALLFACTOR     2      /* times the longest usual pause in the data */
+#define STALLDECAY      0.98   /* the longest pause is forgotten slowly */
+
+enum HandoverState { HO_OFF, HO_CONNECT, HO_FAILED, HO_DATA };
+
+struct handover
+{
+  struct Args        args;       /* of the new stream */
+  char               mountpoint[256];
+  int                line;       /* record of the mountpoint */
+  pthread_t          thread;
+  pthread_mutex_t    mutex;
+  enum HandoverState state;
+  int                connected;  /* set by the thread when it ends */
+  sockettype         sockfd;
+  struct header      header;
+  struct chunky      chunky;
+  struct rtcm3       rtcm3;      /* finds the epochs of the new stream */
+  char               buf[MAXDATASIZE];
+  int                numbytes;   /* data following the header in buf */
+  char               held[HANDOVERHELD];
+  int                heldsize;
+  int                started;    /* an epoch end was found */
+  double             ready;      /* ms when an epoch was complete or 0 */
+  double             retry;      /* ms of the next attempt */
+  int                standby;    /* index of the standby stream or -1 */
+  int                stall;      /* minimum ms without data for a stall */
+  double             lastdata;   /* ms of the last data of the old stream */
+  double             pause;      /* ms of the longest usual pause */
+};
+
+static void *handoverthread(void *data)
+{
+  struct handover *h = data;
+  struct address addresses;
+  struct sockaddr_storage addr;
+  socklen_t len;
+  struct timeval tv = {HANDOVERTIMEOUT, 0};
+  const char *proxyserver;
+  char proxyport[6];
+  sockettype sockfd = -1;
+  int i, res = 1;
+
+  if(!getaddress(&h->args, SOCK_STREAM, &addresses, &proxyserver, proxyport,
+  sizeof(proxyport), 1) && (sockfd = connectrace(&addresses, &addr, &len,
+  h->args.bitrate, -1)) != -1
+  && (i = buildrequest(h->buf, sizeof(h->buf), &h->args, proxyserver,
+  proxyport)) >= 0 && send(sockfd, h->buf, (size_t)i, 0) == i)
+  {
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    headerinit(&h->header);
+    while(!h->header.done && (h->numbytes = recv(sockfd, h->buf,
+    sizeof(h->buf)-1, 0)) > 0 && !(res = checkheader(&h->header, h->buf,
+    &h->numbytes, h->args.mode, &h->chunky)))
+      ;
+    tv.tv_sec = 0;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+  if(res || !h->header.done)
+  {
+    if(sockfd != -1)
+      closesocket(sockfd);
+    sockfd = -1;
+  }
+  pthread_mutex_lock(&h->mutex);
+  h->sockfd = sockfd;
+  h->connected = 1;
+  pthread_mutex_unlock(&h->mutex);
+  return 0;
+}
+
+/* updates the state when the connecting thread ended */
+static void handoverstate(struct handover *h)
+{
+  int connected;
+
+  pthread_mutex_lock(&h->mutex);
+  connected = h->connected;
+  pthread_mutex_unlock(&h->mutex);
+  if(h->state == HO_CONNECT && connected)
+  {
+    pthread_join(h->thread, 0);
+    h->state = h->sockfd != -1 ? HO_DATA : HO_FAILED;
+  }
+}
+
+/* ends a handover which did not switch */
+static void handoverstop(struct handover *h, int failed)
+{
+  if(h->state == HO_OFF)
+    return;
+  if(h->state == HO_CONNECT)
+    pthread_join(h->thread, 0);
+  if(h->sockfd != -1)
+    closesocket(h->sockfd);
+  if(failed)
+  {
+    fprintf(stderr, "%s stream %s failed\n", h->standby < 0 ? "Handover to"
+    : "Standby", h->mountpoint);
+    h->retry = mstime() + HANDOVERRETRY;
+  }
+  h->ready = 0;
+  h->state = HO_OFF;
+}
+
+static void handoverstart(struct handover *h, const struct Args *args,
+const char *mountpoint)
+{
+  h->args = *args;
+  snprintf(h->mountpoint, sizeof(h->mountpoint), "%s", mountpoint);
+  h->args.data = h->mountpoint;
+  h->sockfd = -1;
+  h->numbytes = 0;
+  h->heldsize = 0;
+  h->started = 0;
+  h->ready = 0;
+  h->connected = 0;
+  h->chunky.mode = 0;
+  Rtcm3Reset(&h->rtcm3);
+  h->state = HO_CONNECT;
+  if(pthread_create(&h->thread, 0, handoverthread, h))
+    h->state = HO_OFF;
+  else if(args->bitrate)
+    fprintf(stderr, "%s stream %s started\n", h->standby < 0 ? "Handover to"
+    : "Standby", h->mountpoint);
+}
+
+/* starts a handover when another stream is clearly nearer */
+static void handovercheck(struct handover *h, const struct Args *args,
+const struct nearest *n, double lat, double lon)
+{
+  int line;
+  double km, current;
+
+  if(h->state != HO_OFF || mstime() < h->retry || !n->loaded
+  || SourcetableNearest(&n->index, lat, lon, 1, &line, &km) != 1
+  || !strcmp(SourcetableCell(&n->table, 1, line), n->mountpoint))
+    return;
+  current = SourcetableDistance(&n->table, n->line, lat, lon);
+  if(current < 0 || km + HANDOVERMARGIN < current)
+  {
+    h->standby = -1;
+    h->line = line;
+    handoverstart(h, args, SourcetableCell(&n->table, 1, line));
+  }
+}
+
+/* holds the raw data of the new stream following the end of an epoch, a
+   standby stream starts again at each epoch end, returns 0 when the data
+   does not fit */
+static int handoverdata(struct handover *h, const char *buf, int size)
+{
+  const unsigned char *frame;
+  const char *start = buf, *end = buf+size;
+  int n;
+
+  while((n = Rtcm3Next(&h->rtcm3, &buf, &size, &frame)))
+  {
+    if(Rtcm3EpochEnd(frame, n) != 1)
+      continue;
+    if(!h->started || h->standby >= 0)
+    {
+      h->started = 1;
+      h->heldsize = 0;
+      start = buf;
+    }
+    else if(!h->ready)
+      h->ready = mstime();
+  }
+  if(!h->started)
+    return 1;
+  if(h->heldsize + (end-start) > HANDOVERHELD)
+  {
+    if(h->standby < 0)
+      return 0;
+    h->started = 0; /* wait for the next epoch */
+    h->heldsize = 0;
+    return 1;
+  }
+  memcpy(h->held+h->heldsize, start, end-start);
+  h->heldsize += end-start;
+  return 1;
+}
+
+/* processes numbytes received into h->buf, returns 0 on errors */
+static int handoverinput(struct handover *h, int numbytes)
+{
+  if(h->chunky.mode && (numbytes = dechunk(&h->chunky, h->buf, numbytes)) < 0)
+    return 0;
+  return handoverdata(h, h->buf, numbytes);
+}
+
+/* notes the arrival of data of the old stream */
+static void handoverarrival(struct handover *h)
+{
+  double now = mstime();
+
+  if(h->lastdata)
+  {
+    h->pause *= STALLDECAY;
+    if(now - h->lastdata > h->pause)
+      h->pause = now - h->lastdata;
+  }
+  h->lastdata = now;
+}
+
+/* like waitsocket() while a handover or standby stream runs, the new
+   stream is read meanwhile, sx is 0 without serial device, returns 3 when
+   the old stream did not end its epoch in time and 4 when it stalled */
+static int handoverwait(struct handover *h, sockettype sockfd,
+struct serial *sx, struct nmea *n, FILE *ser)
+{
+  while(!stop && h->state != HO_OFF)
+  {
+    struct pollfd p[3];
+    unsigned long sent = n->sent;
+    double stall = STALLFACTOR*h->pause;
+    int i, num = 2;
+
+    if(h->state == HO_CONNECT)
+    {
+      handoverstate(h);
+      if(h->state == HO_FAILED || (h->state == HO_DATA && ((n->ggalen
+      && send(h->sockfd, n->gga, n->ggalen, 0) != (int)n->ggalen)
+      || !handoverinput(h, h->numbytes))))
+      {
+        handoverstop(h, 1);
+        continue;
+      }
+    }
+    if(h->ready && mstime() > h->ready + HANDOVERWAIT)
+      return 3;
+    if(stall < h->stall)
+      stall = h->stall;
+    if(h->standby >= 0 && h->state == HO_DATA && h->lastdata
+    && mstime() > h->lastdata + stall)
+      return 4;
+    p[0].fd = sockfd;
+    p[1].fd = sx ? sx->Stream : -1; /* ignored by poll() */
+    p[0].events = p[1].events = POLLIN;
+    p[0].revents = p[1].revents = 0;
+    if(h->state == HO_DATA)
+    {
+      p[2].fd = h->sockfd;
+      p[2].events = POLLIN;
+      p[2].revents = 0;
+      num = 3;
+    }
+    if(poll(p, num, 50) < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      myperror("poll");
+      return 1;
+    }
+    if(p[1].revents && (i = readnmea(sx, n, sockfd, ser)))
+      return i;
+    if(num == 3 && ((p[2].revents && ((i = recv(h->sockfd, h->buf,
+    sizeof(h->buf)-1, 0)) <= 0 || !handoverinput(h, i))) || (n->sent != sent
+    && send(h->sockfd, n->gga, n->ggalen, 0) != (int)n->ggalen)))
+      handoverstop(h, 1);
+    if(p[0].revents)
+      return 0;
+  }
+  return stop || !sx ? 0 : waitsocket(sockfd, sx, n, ser);
+}
+
+/* continues the output with the new stream, returns -1 when the serial
+   device failed */
+static int handoverswitch(struct handover *h, struct output *out,
+sockettype *sockfd, struct chunky *c)
+{
+  out->cutepoch = out->epochend = 0;
+  if(out->rtcm3)
+    Rtcm3Reset(out->rtcm3);
+  closesocket(*sockfd);
+  *sockfd = h->sockfd;
+  alarmsocket = *sockfd;
+  *c = h->chunky;
+  h->sockfd = -1;
+  h->ready = 0;
+  h->lastdata = 0;
+  h->state = HO_OFF;
+  return outputdata(out, h->held, h->heldsize);
+}
+
+/* continues with the nearer stream once its epoch is complete */
+static int handovernearest(struct handover *h, struct output *out,
+struct nearest *n, struct Args *args, sockettype *sockfd, struct chunky *c)
+{
+  if(h->state != HO_DATA || !h->ready)
+  {
+    out->cutepoch = out->epochend = 0;
+    return 0;
+  }
+  snprintf(n->mountpoint, sizeof(n->mountpoint), "%s", h->mountpoint);
+  n->line = h->line;
+  args->data = n->mountpoint;
+  fprintf(stderr, "Switched to stream %s\n", n->mountpoint);
+  return handoverswitch(h, out, sockfd, c);
+}
+
+/* the stream given with -m followed by the standby streams given with -a
+   in the order of preference */
+struct streams
+{
+  struct Args args[MAXSTANDBY+1];
+  char        buf[MAXSTANDBY][1000]; /* strings of the URLs */
+  int         num;
+  int         current;  /* stream which is output */
+  int         next;     /* stream connected as standby next */
+};
+
+/* returns 0 on success or an error message */
+static const char *streamsinit(struct streams *s, const struct Args *args)
+{
+  const char *err;
+  int i;
+
+  s->args[0] = *args;
+  for(i = 0; i < args->numstandby; ++i)
+  {
+    struct Args *a = &s->args[i+1];
+    char *bufpos = s->buf[i];
+
+    *a = *args;
+    a->data = 0;
+    if((err = parseurl(args->standby[i], a, &bufpos,
+    s->buf[i]+sizeof(s->buf[i]))))
+      return err;
+    if(!a->data || *a->data == '%')
+      return "Standby streams need a mountpoint.";
+  }
+  s->num = args->numstandby+1;
+  s->current = 0;
+  s->next = 1;
+  return 0;
+}
+
+/* connects the next stream as standby, failing ones are skipped next
+   time */
+static void standbystart(struct handover *h, struct streams *s)
+{
+  h->standby = s->next;
+  handoverstart(h, &s->args[s->next], s->args[s->next].data);
+  do
+  {
+    s->next = (s->next+1) % s->num;
+  } while(s->next == s->current);
+}
+
+/* continues with the standby stream after the current one stalled */
+static int standbyswitch(struct handover *h, struct streams *s,
+struct output *out, struct Args *args, sockettype *sockfd, struct chunky *c)
+{
+  if(h->lastdata)
+    fprintf(stderr, "No data from stream %s for %.0f ms, switched to %s\n",
+    args->data, mstime()-h->lastdata, h->mountpoint);
+  else
+    fprintf(stderr, "Stream %s lost, switched to %s\n", args->data,
+    h->mountpoint);
+  s->current = h->standby;
+  s->next = s->current ? 0 : 1;
+  *args = s->args[s->current];
+  return handoverswitch(h, out, sockfd, c);
+}
+
+/* the next stream in the list is tried when the current one fails */
+static void streamsnext(struct streams *s, struct Args *args)
+{
+  s->current = (s->current+1) % s->num;
+  s->next = s->current ? 0 : 1;
+  *args = s->args[s->current];
+  fprintf(stderr, "Trying stream %s\n", args->data);
+}
+#endif /* HAVE_HANDOVER */
+
+#ifdef HAVE_SPLICE
+/* returns 1 when data can be moved to fd by splice(), which works for
+   pipes and files not opened for appending */
+static int cansplice(int fd)
+{
+  struct stat st;
+  int fl;
+
+  if(fstat(fd, &st) < 0 || (fl = fcntl(fd, F_GETFL)) < 0)
+    return 0;
+  return S_ISFIFO(st.st_mode) || (S_ISREG(st.st_mode) && !(fl & O_APPEND));
+}
+
+/* moves data from the socket to fd without copying it to user space, the
+   pipe p is used in between when fd is no pipe, returns like recv(); when a
+   splice() fails, *failed is set and the data already taken from the socket
+   is written to fd, so the caller can go on with recv() */
+static int splicedata(sockettype sockfd, int fd, const int *p, int *failed)
+{
+  struct pollfd pfd = {sockfd, POLLIN, 0};
+  int n, ofs = 0;
+
+  /* splice() holds the lock of the pipe while it waits for the socket,
+     which would block the reader of fd from data already written */
+  if(poll(&pfd, 1, -1) < 0)
+    return -1;
+  if(p[0] == -1)
+    n = splice(sockfd, 0, fd, 0, SPLICESIZE, SPLICE_F_MOVE);
+  else
+    n = splice(sockfd, 0, p[1], 0, SPLICESIZE, SPLICE_F_MOVE);
+  if(n < 0)
+    *failed = 1;
+  if(n <= 0 || p[0] == -1)
+    return n;
+  while(ofs < n)
+  {
+    int i = splice(p[0], 0, fd, 0, n-ofs, SPLICE_F_MOVE);
+    if(i <= 0)
+      break;
+    ofs += i;
+  }
+  if(ofs < n)
+  {
+    /* the pipe must be empty before the data of recv() follows */
+    char b[MAXDATASIZE];
+    int i;
+
+    *failed = 1;
+    for(; ofs < n; ofs += i)
+    {
+      struct iovec iov;
+      if((i = read(p[0], b, n-ofs < MAXDATASIZE ? n-ofs : MAXDATASIZE)) <= 0)
+        return -1;
+      iov.iov_base = b;
+      iov.iov_len = i;
+      if(writeall(fd, &iov, 1) < 0)
+        return -1;
+    }
+  }
+  return n;
+}
+#endif /* HAVE_SPLICE */
+
+#ifdef HAVE_EPOLL
+/* gateway mode: many streams fetched by one epoll based event loop */
+#define GATEWAYMAXLINE 1024
+#define GATEWAYBUFSIZE 16384
+#define GATEWAYSTEP    50 /* ms between the checks of a running name lookup */
+
+enum GatewayState { GW_OFF, GW_WAIT, GW_CONNECT, GW_SEND, GW_HEADER, GW_DATA };
+
+struct gwstream
+{
+  struct Args        args;
+  char               urlbuf[1000];   /* strings of args */
+  char              *url;
+  char              *outname;
+  struct output      out;
+  struct address     addr;
+  sockettype         race[MAXADDRESSES]; /* connects to the addresses */
+  int                started;        /* addresses tried */
+  int                pending;        /* connects still running */
+  double             nextstart;      /* ms, the next address is tried */
+  const char        *proxyserver;
+  char               proxyport[6];
+  sockettype         sockfd;
+  enum GatewayState  state;
+  struct rtcm3       rtcm3;
+  char               request[MAXDATASIZE];
+  int                reqpos;
+  int                reqlen;
+  struct chunky      chunky;
+  struct header      header;
+  time_t             nexttry;
+  time_t             lastdata;
+  double             connectstart;   /* ms */
+  struct reconnect   reconnect;
+#ifdef HAVE_METRICS
+  struct metrics     metrics;
+#endif
+};
+
+/* reads the stream list, each line has the form "url [mode] output", where
+   output is a file name or '-' for stdout, returns the number of streams
+   or -1 on errors */
+static int gatewayload(const struct Args *defaults, struct gwstream ***list)
+{
+  char line[GATEWAYMAXLINE];
+  struct gwstream **streams = 0;
+  int num = 0, max = 0, linenum = 0, res = 1;
+  FILE *f;
+
+  if(!(f = fopen(defaults->gateway, "r")))
+  {
+    fprintf(stderr, "Could not open gateway list '%s'.\n", defaults->gateway);
+    return -1;
+  }
+  while(res && fgets(line, sizeof(line), f))
+  {
+    char *field[4], *tok, *bufpos;
+    const char *err;
+    struct gwstream *g;
+    int n = 0;
+
+    ++linenum;
+    for(tok = strtok(line, " \t\r\n"); tok && n < 4; tok = strtok(0, " \t\r\n"))
+      field[n++] = tok;
+    if(!n || *field[0] == '#')
+      continue;
+    res = 0;
+    if(n < 2 || n > 3)
+      fprintf(stderr, "%s:%d: expected 'url [mode] output'.\n",
+      defaults->gateway, linenum);
+    else if(num == max && !(streams = realloc(streams,
+    (max = max ? max*2 : 16)*sizeof(*streams))))
+      fprintf(stderr, "Could not allocate memory.\n");
+    else if(!(g = calloc(1, sizeof(*g))))
+      fprintf(stderr, "Could not allocate memory.\n");
+    else
+    {
+      streams[num++] = g;
+      if(defaults->frames)
+        g->out.rtcm3 = &g->rtcm3;
+      g->args = *defaults;
+      g->args.data = 0;
+      g->sockfd = -1;
+      g->state = GW_WAIT;
+      bufpos = g->urlbuf;
+      if(!(g->url = strdup(field[0])) || !(g->outname = strdup(field[n-1])))
+        fprintf(stderr, "Could not allocate memory.\n");
+      else if((err = parseurl(g->url, &g->args, &bufpos,
+      g->urlbuf+sizeof(g->urlbuf))))
+        fprintf(stderr, "%s:%d: %s\n", defaults->gateway, linenum, err);
+      else if(!g->args.data || *g->args.data == '%')
+        fprintf(stderr, "%s:%d: a mountpoint is required.\n",
+        defaults->gateway, linenum);
+      else if(n == 3 && !(g->args.mode = getmode(field[1])))
+        fprintf(stderr, "%s:%d: Mode %s unknown\n", defaults->gateway,
+        linenum, field[1]);
+      else if(g->args.mode == RTSP || g->args.mode == UDP)
+        fprintf(stderr, "%s:%d: only the TCP based modes are supported.\n",
+        defaults->gateway, linenum);
+      else if(!strcmp(g->outname, "-"))
+        g->out.file = stdout;
+      else if(!(g->out.file = fopen(g->outname, "ab")))
+        fprintf(stderr, "%s:%d: Could not open output file '%s'.\n",
+        defaults->gateway, linenum, g->outname);
+      if(g->out.file)
+        res = 1;
+    }
+  }
+  fclose(f);
+  *list = streams;
+  if(res && !num)
+  {
+    fprintf(stderr, "No streams in gateway list '%s'.\n", defaults->gateway);
+    res = 0;
+  }
+  return res ? num : -num-1;
+}
+
+static void gatewayfree(struct gwstream **streams, int num)
+{
+  int i;
+  for(i = 0; i < num; ++i)
+  {
+    struct gwstream *g = streams[i];
+    int j;
+    if(g->sockfd != -1)
+      closesocket(g->sockfd);
+    for(j = 0; g->state == GW_CONNECT && j < g->started; ++j)
+    {
+      if(g->race[j] != -1)
+        closesocket(g->race[j]);
+    }
+    if(g->out.file && g->out.file != stdout)
+      fclose(g->out.file);
+    free(g->out.age);
+    free(g->url);
+    free(g->outname);
+    free(g);
+  }
+  free(streams);
+}
+
+/* closes the connects which did not win the race */
+static void gatewaycancel(struct gwstream *g, int epfd)
+{
+  int i;
+  for(i = 0; i < g->started; ++i)
+  {
+    if(g->race[i] != -1 && g->race[i] != g->sockfd)
+    {
+      epoll_ctl(epfd, EPOLL_CTL_DEL, g->race[i], 0);
+      closesocket(g->race[i]);
+    }
+    g->race[i] = -1;
+  }
+  g->pending = 0;
+}
+
+/* closes the connection, retry == 0 disables the stream */
+static void gatewayclose(struct gwstream *g, int epfd, int retry)
+{
+  if(g->state == GW_CONNECT)
+    gatewaycancel(g, epfd);
+  if(g->sockfd != -1)
+  {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, g->sockfd, 0);
+    closesocket(g->sockfd);
+    g->sockfd = -1;
+  }
+  if(!retry)
+  {
+    fprintf(stderr, "%s: stream disabled.\n", g->args.data);
+    g->state = GW_OFF;
+  }
+  else
+  {
+    reconnectlost(&g->reconnect);
+    MetricsReconnect(g->out.metrics);
+    g->state = GW_WAIT;
+    g->nexttry = time(0) + (time_t)(reconnectdelay(&g->reconnect)+999)/1000;
+  }
+}
+
+/* starts a non-blocking connect to the next address of the caster,
+   returns 0 or the error */
+static int gatewaystart(struct gwstream *g, int epfd)
+{
+  struct sockaddr_storage *addr = &g->addr.addr[g->started];
+  struct epoll_event ev;
+  sockettype *s = &g->race[g->started];
+  int err;
+
+  g->nextstart = mstime() + CONNECTDELAY;
+  if((*s = socket(addr->ss_family, SOCK_STREAM, 0)) == -1)
+    return errno;
+  ev.events = EPOLLOUT;
+  ev.data.ptr = g;
+  if(fcntl(*s, F_SETFL, O_NONBLOCK) < 0
+  || epoll_ctl(epfd, EPOLL_CTL_ADD, *s, &ev) < 0
+  || (connect(*s, (struct sockaddr *)addr, g->addr.len[g->started]) == -1
+  && errno != EINPROGRESS))
+  {
+    err = errno;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, *s, 0);
+    closesocket(*s);
+    *s = -1;
+    return err;
+  }
+  ++g->pending;
+  return 0;
+}
+
+/* while connects are pending the next address is tried every CONNECTDELAY
+   ms like in connectrace(), when no address can be reached the name is
+   looked up again, returns the ms until the next call is due */
+static int gatewayrace(struct gwstream *g, int epfd)
+{
+  double now = mstime();
+  int err;
+
+  while(g->started < g->addr.num && (now >= g->nextstart || !g->pending))
+  {
+    err = gatewaystart(g, epfd);
+    ++g->started;
+    if(err)
+      fprintf(stderr, "%s: connect: %s\n", g->args.data, strerror(err));
+  }
+  if(!g->pending || now - g->connectstart > CONNECTTIMEOUT)
+  {
+    if(g->pending)
+      fprintf(stderr, "%s: connect: %s\n", g->args.data, strerror(ETIMEDOUT));
+    forgetaddress(&g->args, SOCK_STREAM);
+    gatewayclose(g, epfd, 1);
+    return 1000;
+  }
+  return 1 + (int)((g->started < g->addr.num ? g->nextstart
+  : g->connectstart + CONNECTTIMEOUT) - now);
+}
+
+static void gatewayconnect(struct gwstream *g, int epfd)
+{
+  int i;
+
+  /* streams from the same caster share the cached name lookup, which is
+     done in the background, so the event loop never waits for the DNS */
+  if((i = getaddress(&g->args, SOCK_STREAM, &g->addr, &g->proxyserver,
+  g->proxyport, sizeof(g->proxyport), 0)) == -1)
+    return; /* tried again with the next check */
+  if(i)
+  {
+    gatewayclose(g, epfd, i != 2);
+    return;
+  }
+  if((g->reqlen = buildrequest(g->request, sizeof(g->request), &g->args,
+  g->proxyserver, g->proxyport)) < 0)
+  {
+    gatewayclose(g, epfd, 0);
+    return;
+  }
+  g->reqpos = 0;
+  g->chunky.mode = g->chunky.size = 0;
+  headerinit(&g->header);
+  if(g->out.rtcm3)
+    Rtcm3Reset(g->out.rtcm3);
+  g->lastdata = time(0);
+  g->connectstart = mstime();
+  g->started = g->pending = 0;
+  g->state = GW_CONNECT;
+  gatewayrace(g, epfd);
+}
+
+static void gatewayevent(struct gwstream *g, int epfd, char *buf, int size)
+{
+  struct epoll_event ev;
+  int numbytes, i;
+
+  if(g->state == GW_CONNECT)
+  {
+    /* the event does not tell which of the connects finished */
+    struct pollfd p[MAXADDRESSES];
+    for(i = 0; i < g->started; ++i)
+    {
+      p[i].fd = g->race[i];
+      p[i].events = POLLOUT;
+      p[i].revents = 0;
+    }
+    poll(p, g->started, 0);
+    for(i = 0; i < g->started && g->sockfd == -1; ++i)
+    {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      if(!p[i].revents)
+        continue;
+      if(getsockopt(p[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)
       {
-        sleeptime = 1;
+        fprintf(stderr, "%s: connect: %s\n", g->args.data,
+        strerror(err ? err : errno));
+        epoll_ctl(epfd, EPOLL_CTL_DEL, p[i].fd, 0);
+        closesocket(p[i].fd);
+        g->race[i] = -1;
+        --g->pending;
+        g->nextstart = 0; /* try the next address immediately */
       }
-#ifndef WINDOWSVERSION
-      alarm(ALARMTIME);
+      else
+        g->sockfd = p[i].fd;
+    }
+    if(g->sockfd == -1)
+    {
+      gatewayrace(g, epfd);
+      return;
+    }
+    gatewaycancel(g, epfd);
+    g->state = GW_SEND;
+  }
+  if(g->state == GW_SEND)
+  {
+    if((i = send(g->sockfd, g->request+g->reqpos, g->reqlen-g->reqpos,
+    MSG_NOSIGNAL)) < 0)
+    {
+      if(errno != EAGAIN)
+      {
+        fprintf(stderr, "%s: send: %s\n", g->args.data, strerror(errno));
+        gatewayclose(g, epfd, 1);
+      }
+    }
+    else if((g->reqpos += i) == g->reqlen)
+    {
+      ev.events = EPOLLIN;
+      ev.data.ptr = g;
+      epoll_ctl(epfd, EPOLL_CTL_MOD, g->sockfd, &ev);
+      g->state = GW_HEADER;
+    }
+    return;
+  }
+
+  if((numbytes = recv(g->sockfd, buf, size-1, 0)) <= 0)
+  {
+    if(numbytes < 0 && errno == EAGAIN)
+      return;
+    fprintf(stderr, "%s: %s\n", g->args.data,
+    numbytes ? strerror(errno) : "Connection closed.");
+    gatewayclose(g, epfd, 1);
+    return;
+  }
+  g->lastdata = time(0);
+  if(g->out.age)
+    g->out.arrival = utctime();
+  MetricsRecv(g->out.metrics, numbytes);
+  if(g->state == GW_HEADER)
+  {
+    if((i = checkheader(&g->header, buf, &numbytes, g->args.mode,
+    &g->chunky)))
+    {
+      gatewayclose(g, epfd, i != 2);
+      return;
+    }
+    if(g->header.done)
+    {
+      MetricsHandshake(g->out.metrics, mstime()-g->connectstart);
+      g->state = GW_DATA;
+    }
+  }
+  if(numbytes && g->chunky.mode
+  && (numbytes = dechunk(&g->chunky, buf, numbytes)) < 0)
+  {
+    fprintf(stderr, "%s: Error in chunky transfer encoding\n", g->args.data);
+    MetricsChunkError(g->out.metrics);
+    gatewayclose(g, epfd, 1);
+  }
+  else if(numbytes)
+  {
+    if(reconnectdata(&g->reconnect) > 0 && g->args.bitrate)
+      reconnectstats(g->args.data, &g->reconnect);
+    outputdata(&g->out, buf, numbytes);
+    fflush(g->out.file);
+  }
+}
+
+static int gateway(const struct Args *args)
+{
+  struct gwstream **streams = 0;
+  struct epoll_event events[64];
+  char buf[GATEWAYBUFSIZE];
+  time_t lastcheck = 0;
+  int num, i, n, epfd, active = 1, busy = 0, wait;
+#ifdef HAVE_METRICS
+  struct metricsserver metrics;
+#endif
+
+  if((num = gatewayload(args, &streams)) < 0)
+  {
+    gatewayfree(streams, -num-1);
+    return 20;
+  }
+  if((epfd = epoll_create(num+1)) < 0)
+  {
+    myperror("epoll_create");
+    gatewayfree(streams, num);
+    return 20;
+  }
+#ifdef HAVE_METRICS
+  if(args->metrics)
+  {
+    struct metrics *list = 0;
+    const char *e;
+    /* one set of counters for each stream */
+    for(i = num; i-- > 0;)
+    {
+      MetricsInit(&streams[i]->metrics, streams[i]->args.data);
+      streams[i]->metrics.next = list;
+      list = streams[i]->out.metrics = &streams[i]->metrics;
+      if(args->frames)
+        streams[i]->out.age = calloc(1, sizeof(struct rtcm3age));
+    }
+    if((e = MetricsStart(&metrics, args->metrics, list)))
+    {
+      fprintf(stderr, "%s\n", e);
+      close(epfd);
+      gatewayfree(streams, num);
+      return 20;
+    }
+  }
 #endif
-      if(args.proxyhost)
+  alarm(0); /* inactivity is checked for each stream separately */
+  while(!stop && active)
+  {
+    time_t now = time(0);
+    if(now != lastcheck)
+    {
+      lastcheck = now;
+      for(i = 0, active = 0; i < num; ++i)
       {
-        int p;
-        if((i = strtol(args.port, &b, 10)) && (!b || !*b))
-          p = i;
-        else if(!(se = getservbyname(args.port, 0)))
+        struct gwstream *g = streams[i];
+        if(g->state == GW_WAIT && now >= g->nexttry)
         {
-          fprintf(stderr, "Can't resolve port %s.", args.port);
-          stop = 1;
+          gatewayconnect(g, epfd);
+          busy = 1;
         }
-        else
+        else if(g->state > GW_WAIT && now - g->lastdata > ALARMTIME)
         {
-          p = ntohs(se->s_port);
+          fprintf(stderr, "%s: more than %d seconds no activity\n",
+          g->args.data, ALARMTIME);
+          gatewayclose(g, epfd, 1);
         }
-        if(!stop && !error)
+        if(g->state != GW_OFF)
+          ++active;
+      }
+    }
+    /* name lookups and further addresses are handled between the checks,
+       a stream still waiting after its connect waits for the lookup */
+    wait = 1000;
+    for(i = 0, n = busy, busy = 0; n && i < num; ++i)
+    {
+      struct gwstream *g = streams[i];
+      int ms = GATEWAYSTEP;
+      if(g->state == GW_WAIT && g->nexttry <= now)
+        gatewayconnect(g, epfd);
+      else if(g->state == GW_CONNECT)
+        ms = gatewayrace(g, epfd);
+      if(g->state == GW_CONNECT || (g->state == GW_WAIT && g->nexttry <= now))
+      {
+        busy = 1;
+        if(ms < wait)
+          wait = ms;
+      }
+    }
+    if((n = epoll_wait(epfd, events, sizeof(events)/sizeof(events[0]),
+    wait)) < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      myperror("epoll_wait");
+      break;
+    }
+    for(i = 0; i < n; ++i)
+      gatewayevent(events[i].data.ptr, epfd, buf, sizeof(buf));
+  }
+#ifdef HAVE_METRICS
+  if(args->metrics)
+    MetricsStop(&metrics);
+#endif
+  close(epfd);
+  gatewayfree(streams, num);
+  return 0;
+}
+#endif /* HAVE_EPOLL */
+
+int main(int argc, char **argv)
+{
+  struct Args args;
+
+  setbuf(stdin, 0);
+  setbuf(stderr, 0);
+#ifndef WINDOWSVERSION
+  signal(SIGALRM,sighandler_alarm);
+  signal(SIGINT,sighandler_int);
+  alarm(ALARMTIME);
+#else
+  WSADATA wsaData;
+  if(WSAStartup(MAKEWORD(1,1),&wsaData))
+  {
+    fprintf(stderr, "Could not init network access.\n");
+    return 20;
+  }
+#endif
+
+  if(getargs(argc, argv, &args))
+  {
+    struct serial sx;
+    struct rtcm3 rtcm3;
+    struct rtcm3epoch epoch;
+    struct rtcm3age age;
+    struct rtpbuffer rtp;
+    struct rtpbatch batch;
+    struct output out;
+#ifdef HAVE_SERIALQUEUE
+    struct serialqueue queue;
+#endif
+#ifdef HAVE_FANOUT
+    struct fanout fanout;
+#endif
+#ifdef HAVE_METRICS
+    struct metricsserver metricsserver;
+    struct metrics metrics;
+#endif
+    FILE *ser = 0;
+    struct nmea nmea;
+    struct nearest nearest;
+#ifdef HAVE_HANDOVER
+    static struct handover handover;
+    static struct streams streams;
+#endif
+#ifdef HAVE_MERGE
+    static struct mergestream merge;
+#endif
+    struct reconnect reconnect;
+#ifdef HAVE_SPLICE
+    int splicepipe[2] = {-1, -1};
+#endif
+    /* each client needs its own random reconnect times */
+#ifdef WINDOWSVERSION
+    srand(time(0) ^ GetCurrentProcessId());
+#else
+    srand(time(0) ^ (getpid() << 16));
+#endif
+    if(args.gateway && args.numlisten)
+    {
+      fprintf(stderr, "Local clients are not supported in gateway mode.\n");
+      return 20;
+    }
+#ifndef HAVE_FANOUT
+    if(args.numlisten)
+    {
+      fprintf(stderr, "Local clients are not supported on this system.\n");
+      return 20;
+    }
+#endif
+#ifndef HAVE_METRICS
+    if(args.metrics)
+    {
+      fprintf(stderr, "Metrics are not supported on this system.\n");
+      return 20;
+    }
+#endif
+    if(args.gateway)
+    {
+#ifdef HAVE_EPOLL
+      return gateway(&args);
+#else
+      fprintf(stderr, "Gateway mode is not supported on this system.\n");
+      return 20;
+#endif
+    }
+    memset(&nmea, 0, sizeof(nmea));
+    nmea.period = args.ggaperiod;
+    nmea.move = args.ggamove/1000.0;
+    memset(&nearest, 0, sizeof(nearest));
+#ifdef HAVE_HANDOVER
+    pthread_mutex_init(&handover.mutex, 0);
+    handover.standby = -1;
+    handover.stall = args.stall;
+    if(args.numstandby)
+    {
+      const char *e;
+      if(args.nearest || args.mode == UDP || args.mode == RTSP || !args.data
+      || *args.data == '%')
+      {
+        fprintf(stderr, "Standby streams need a mountpoint and a TCP based "
+        "mode and cannot be used with -N.\n");
+        return 20;
+      }
+      if((e = streamsinit(&streams, &args)))
+      {
+        fprintf(stderr, "%s\n", e);
+        return 20;
+      }
+    }
+#else
+    if(args.numstandby)
+    {
+      fprintf(stderr, "Standby streams are not supported on this system.\n");
+      return 20;
+    }
+#endif
+    if(args.nearest)
+    {
+      if(args.data && *args.data != '%')
+      {
+        fprintf(stderr, "With -N the argument -m must be a sourcetable query.\n");
+        return 20;
+      }
+      if(args.nmea && ggaposition(args.nmea, &nmea.lat, &nmea.lon))
+        nmea.position = 1;
+      else if(!args.serdevice)
+      {
+        fprintf(stderr, "The nearest stream is selected for the position of "
+        "a GGA sentence given with -n or read from the serial device.\n");
+        return 20;
+      }
+      if(args.data)
+        args.query = decodeurl(args.data);
+      args.data = 0;
+    }
+    else if(args.stcache && (!args.data || *args.data == '%'))
+    {
+      int cached;
+      if(args.mode == UDP || args.mode == RTSP)
+      {
+        fprintf(stderr, "The sourcetable cache needs a TCP based mode.\n");
+        return 20;
+      }
+      if(args.data)
+        args.query = decodeurl(args.data);
+      if((cached = cachedsourcetable(&args)))
+        return cached == 1 ? 0 : 1;
+      args.data = 0; /* the cache gets the complete sourcetable */
+    }
+    memset(&out, 0, sizeof(out));
+    memset(&reconnect, 0, sizeof(reconnect));
+    out.file = stdout;
+    /* standard output is written in blocks, see outputwait() */
+    if(args.batch && args.batchwait && !args.serdevice)
+    {
+      setvbuf(stdout, 0, _IOFBF, args.batch);
+      out.batchwait = args.batchwait/1000.0;
+    }
+    else
+      setbuf(stdout, 0);
+#ifdef HAVE_METRICS
+    if(args.metrics)
+    {
+      const char *e;
+      MetricsInit(&metrics, args.data ? args.data : "");
+      if((e = MetricsStart(&metricsserver, args.metrics, &metrics)))
+      {
+        fprintf(stderr, "%s\n", e);
+        return 20;
+      }
+      out.metrics = nmea.metrics = &metrics;
+    }
+#endif
+    if(args.frames)
+    {
+      memset(&rtcm3, 0, sizeof(rtcm3));
+      out.rtcm3 = &rtcm3;
+      if(args.epochwait)
+      {
+        memset(&epoch, 0, sizeof(epoch));
+        out.epoch = &epoch;
+        out.epochwait = args.epochwait;
+      }
+      if(args.bitrate || args.metrics)
+      {
+        memset(&age, 0, sizeof(age));
+        out.age = &age;
+      }
+    }
+    if(args.serdevice)
+    {
+      const char *e = SerialInit(&sx, args.serdevice, args.baud,
+      args.stopbits, args.protocol, args.parity, args.databits, 1);
+      if(e)
+      {
+        fprintf(stderr, "%s\n", e);
+        return 20;
+      }
+      if(args.vmin != 1 || args.vtime || args.lowlatency)
+      {
+#ifdef HAVE_SERIALTIMING
+        if((e = SerialTiming(&sx, args.vmin, args.vtime, args.lowlatency)))
         {
-          snprintf(proxyport, sizeof(proxyport), "%d", p);
-          port = args.proxyport;
-          proxyserver = args.server;
-          server = args.proxyhost;
+          SerialFree(&sx);
+          fprintf(stderr, "%s\n", e);
+          return 20;
         }
+#else
+        SerialFree(&sx);
+        fprintf(stderr, "Serial read settings are not supported on this "
+        "system.\n");
+        return 20;
+#endif
       }
-      else
+      out.serial = &sx;
+      if(args.serqueue || args.sermaxage)
       {
-        server = args.server;
-        port = args.port;
+#ifdef HAVE_SERIALQUEUE
+        if((e = SerialQueueStart(&queue, &sx, args.serqueue,
+        args.overflow ? SPAOVERFLOW_BLOCK : SPAOVERFLOW_DROP, args.sermaxage,
+        args.bitrate)))
+        {
+          SerialFree(&sx);
+          fprintf(stderr, "%s\n", e);
+          return 20;
+        }
+        out.queue = &queue;
+#else
+        SerialFree(&sx);
+        fprintf(stderr, "Serial queue is not supported on this system.\n");
+        return 20;
+#endif
       }
-      if(!stop && !error)
+      if(args.serlogfile)
       {
-        memset(&their_addr, 0, sizeof(struct sockaddr_in));
-        if((i = strtol(port, &b, 10)) && (!b || !*b))
-          their_addr.sin_port = htons(i);
-        else if(!(se = getservbyname(port, 0)))
+        if(!(ser = fopen(args.serlogfile, "a+")))
         {
-          fprintf(stderr, "Can't resolve port %s.", port);
-          stop = 1;
+#ifdef HAVE_SERIALQUEUE
+          if(out.queue)
+            SerialQueueStop(out.queue);
+#endif
+          SerialFree(&sx);
+          fprintf(stderr, "Could not open serial logfile.\n");
+          return 20;
         }
-        else
+      }
+    }
+#ifdef HAVE_FANOUT
+    if(args.numlisten)
+    {
+      const char *e = FanoutStart(&fanout, args.listen, args.numlisten,
+      !args.frames);
+      if(e)
+      {
+        if(args.serdevice)
         {
-          their_addr.sin_port = se->s_port;
+#ifdef HAVE_SERIALQUEUE
+          if(out.queue)
+            SerialQueueStop(out.queue);
+#endif
+          SerialFree(&sx);
         }
-        if(!stop && !error)
+        if(ser)
+          fclose(ser);
+        fprintf(stderr, "%s\n", e);
+        return 20;
+      }
+      out.fanout = &fanout;
+    }
+#endif
+    if(args.merge)
+    {
+#ifdef HAVE_MERGE
+      const char *e;
+      if(!args.frames)
+      {
+        fprintf(stderr, "Merging two paths needs the RTCM3 frames (-F).\n");
+        return 20;
+      }
+      if((e = mergestart(&merge, &args, &out)))
+      {
+        fprintf(stderr, "%s\n", e);
+        return 20;
+      }
+#else
+      fprintf(stderr, "Merging two paths is not supported on this system.\n");
+      return 20;
+#endif
+    }
+    /* the first request needs the position of the rover */
+    while(args.nearest && !nmea.position && !stop)
+    {
+      if(readnmea(&sx, &nmea, 0, ser))
+        stop = 1;
+      else if(!nmea.position)
+        waitms(100);
+    }
+    do
+    {
+      int error = 0;
+      sockettype sockfd = 0;
+      int numbytes;
+      char buf[MAXDATASIZE];
+      struct address addresses;
+      struct sockaddr_storage their_addr; /* connector's address information */
+      socklen_t their_len = 0;
+      double connectstart;
+      const char *proxyserver = 0;
+      char proxyport[6];
+      long i;
+      double delay = reconnectdelay(&reconnect);
+#ifdef HAVE_HANDOVER
+      if(streams.num > 1 && reconnect.attempts > 1)
+        streamsnext(&streams, &args);
+#endif
+      if(delay > 0)
+      {
+        if(args.bitrate)
+          fprintf(stderr, "Reconnecting in %.1f s.\n", delay/1000.0);
+#ifndef WINDOWSVERSION
+        alarm(0);
+#endif
+        waitms(delay);
+        if(stop)
+          break;
+      }
+#ifndef WINDOWSVERSION
+      alarm(ALARMTIME);
+#endif
+      if(out.rtcm3)
+        Rtcm3Reset(out.rtcm3);
+      connectstart = mstime();
+      if(args.nearest && (i = nearestmountpoint(&args, &nearest, nmea.lat,
+      nmea.lon)))
+      {
+        if(i == 2)
+          stop = 1;
+        else
+          error = 1;
+      }
+      else if((i = getaddress(&args, args.mode == UDP ? SOCK_DGRAM : SOCK_STREAM,
+      &addresses, &proxyserver, proxyport, sizeof(proxyport), 1)) == 2)
+        stop = 1;
+      else if(i)
+        error = 1;
+      else if(args.mode == UDP)
+      {
+        their_addr = addresses.addr[0];
+        their_len = addresses.len[0];
+        if((sockfd = socket(their_addr.ss_family, SOCK_DGRAM, 0)) == -1)
         {
-          if(!(he=gethostbyname(server)))
-          {
-            fprintf(stderr, "Server name lookup failed for '%s'.\n", server);
-            error = 1;
-          }
-          else if((sockfd = socket(AF_INET, (args.mode == UDP ? SOCK_DGRAM :
-          SOCK_STREAM), 0)) == -1)
-          {
-            myperror("socket");
-            error = 1;
-          }
-          else
-          {
-            their_addr.sin_family = AF_INET;
-            their_addr.sin_addr = *((struct in_addr *)he->h_addr);
-          }
+          myperror("socket");
+          error = 1;
         }
       }
+      else if((sockfd = connectrace(&addresses, &their_addr, &their_len,
+      args.bitrate, -1)) == -1)
+      {
+        forgetaddress(&args, SOCK_STREAM);
+        error = 1;
+      }
+#ifndef WINDOWSVERSION
+      if(!stop && !error)
+        alarmsocket = sockfd;
+#endif
       if(!stop && !error)
       {
         if(args.mode == UDP)
@@ -711,7 +4241,6 @@ int main(int argc, char **argv)
           int i=12, j;
 
           init = time(0);
-          srand(init);
           session = rand();
           tim = rand();
           seq = rand();
@@ -760,7 +4289,7 @@ int main(int argc, char **argv)
             }
             else
             {
-              struct sockaddr_in local;
+              struct sockaddr_storage local;
               socklen_t len;
 
               rtpbuf[i++] = '\r';
@@ -770,11 +4299,7 @@ int main(int argc, char **argv)
 
 
               /* fill structure with local address information for UDP */
-              memset(&local, 0, sizeof(local));
-              local.sin_family = AF_INET;
-              local.sin_port = htons(args.udpport);
-              local.sin_addr.s_addr = htonl(INADDR_ANY);
-              len = sizeof(local);
+              len = localaddress(&local, their_addr.ss_family, args.udpport);
 
               /* bind() in order to get a random RTP client_port */
               if((bind(sockfd, (struct sockaddr *)&local, len)) < 0)
@@ -783,7 +4308,7 @@ int main(int argc, char **argv)
                 error = 1;
               }
               else if(connect(sockfd, (struct sockaddr *)&their_addr,
-              sizeof(struct sockaddr)) == -1)
+              their_len) == -1)
               {
                 myperror("connect");
                 error = 1;
@@ -797,118 +4322,45 @@ int main(int argc, char **argv)
               {
                 if((numbytes=recv(sockfd, rtpbuf, sizeof(rtpbuf)-1, 0)) > 0)
                 {
-                  int sn = 0x10000, ts=0;
+                  struct header header;
                   /* we don't expect message longer than 1513, so we cut the last
                     byte for security reasons to prevent buffer overrun */
                   rtpbuf[numbytes] = 0;
-                  if(numbytes > 17+12 &&
-                  (!strncmp(rtpbuf+12, "HTTP/1.1 200 OK\r\n", 17) ||
-                  !strncmp(rtpbuf+12, "HTTP/1.0 200 OK\r\n", 17)))
+                  headerinit(&header);
+                  i = numbytes > 12 ? headerparse(&header, rtpbuf+12, numbytes-12)
+                  : 0;
+                  if(header.status == 200 && !header.icy
+                  && !strncmp(header.statusline, "HTTP/", 5))
                   {
-                    const char *sessioncheck = "session: ";
-                    const char *datacheck = "Content-Type: gnss/data\r\n";
-                    const char *sourcetablecheck = "Content-Type: gnss/sourcetable\r\n";
-                    const char *contentlengthcheck = "Content-Length: ";
-                    const char *httpresponseend = "\r\n\r\n";
-                    int contentlength = 0, httpresponselength = 0;
-                    /* datacheck */
-                    int l = strlen(datacheck)-1;
-                    int j=0;
-                    for(i = 12; j != l && i < numbytes-l; ++i)
+                    if(header.gnssdata)
                     {
-                      for(j = 0; j < l && rtpbuf[i+j] == datacheck[j]; ++j)
-                        ;
+                      /* found a session number */
+                      if(header.hassession)
+                        session = header.session;
+                      MetricsHandshake(out.metrics, mstime()-connectstart);
                     }
-                    if(i != numbytes-l)
+                    else if(!header.sourcetable)
                     {
-                      /* check for Session */
-                      l = strlen(sessioncheck)-1;
-                      j=0;
-                      for(i = 12; j != l && i < numbytes-l; ++i)
-                      {
-                        for(j = 0; j < l && tolower(rtpbuf[i+j]) == sessioncheck[j]; ++j)
-                          ;
-                      }
-                      if(i != numbytes-l) /* found a session number */
-                      {
-                        i+=l;
-                        session = 0;
-                        while(i < numbytes && rtpbuf[i] >= '0' && rtpbuf[i] <= '9')
-                          session = session * 10 + rtpbuf[i++]-'0';
-                        if(rtpbuf[i] != '\r')
-                        {
-                          fprintf(stderr, "Could not extract session number\n");
-                          stop = 1;
-                        }
-                      }
+                      fprintf(stderr, "No 'Content-Type: gnss/data' or"
+                              " 'Content-Type: gnss/sourcetable' found\n");
+                      error = 1;
                     }
-                    else
+                    else if(header.contentlength >= 0)
                     {
-                      /* sourcetablecheck */
-                      l = strlen(sourcetablecheck)-1;
-                      j=0;
-                      for(i = 12; j != l && i < numbytes-l; ++i)
-                      {
-                        for(j = 0; j < l && rtpbuf[i+j] == sourcetablecheck[j]; ++j)
-                          ;
-                      }
-                      if(i == numbytes-l)
-                      {
-                        fprintf(stderr, "No 'Content-Type: gnss/data' or"
-                                " 'Content-Type: gnss/sourcetable' found\n");
-                        error = 1;
-                      }
-                      else
+                      int contentlength = header.contentlength
+                      + (header.done ? i : 0);
+                      do
                       {
-                        /* check for http response end */
-                        l = strlen(httpresponseend)-1;
-                        j=0;
-                        for(i = 12; j != l && i < numbytes-l; ++i)
-                        {
-                          for(j = 0; j < l && rtpbuf[i+j] == httpresponseend[j]; ++j)
-                            ;
-                        }
-                        if(i != numbytes-l) /* found http response end */
-                        {
-                            httpresponselength = i+3-12;
-                        }
-                        /* check for content length */
-                        l = strlen(contentlengthcheck)-1;
-                        j=0;
-                        for(i = 12; j != l && i < numbytes-l; ++i)
+                        fwrite(rtpbuf+12, (size_t)numbytes-12, 1, stdout);
+                        if((contentlength -= (numbytes-12)) == 0)
                         {
-                          for(j = 0; j < l && rtpbuf[i+j] == contentlengthcheck[j]; ++j)
-                            ;
+                          stop = 1;
                         }
-                        if(i != numbytes-l) /* found content length */
+                        else
                         {
-                          i+=l;
-                          contentlength = 0;
-                          while(i < numbytes && rtpbuf[i] >= '0' && rtpbuf[i] <= '9')
-                            contentlength = contentlength * 10 + rtpbuf[i++]-'0';
-                          if(rtpbuf[i] == '\r')
-                          {
-                            contentlength += httpresponselength;
-                            do
-                            {
-                              fwrite(rtpbuf+12, (size_t)numbytes-12, 1, stdout);
-                              if((contentlength -= (numbytes-12)) == 0)
-                              {
-                                stop = 1;
-                              }
-                              else
-                              {
-                                numbytes = recv(sockfd, rtpbuf, sizeof(rtpbuf), 0);
-                              }
-                            }while((numbytes >12) && (!stop));
-                          }
-                          else
-                          {
-                            fprintf(stderr, "Could not extract content length\n");
-                            stop = 1;
-                          }
+                          numbytes = recv(sockfd, rtpbuf, sizeof(rtpbuf), 0);
                         }
-                      }
+                      }while((numbytes >12) && (!stop));
                     }
                   }
                   else
@@ -922,62 +4374,68 @@ int main(int argc, char **argv)
                     fprintf(stderr, "\n");
                     error = 1;
                   }
+                  RtpInit(&rtp, args.latency);
                   while(!stop && !error)
                   {
-                    struct timeval tv = {1,0};
+                    struct timeval tv;
                     fd_set fdr;
                     fd_set fde;
+                    unsigned int w;
+                    int n, k, valid;
 
                     FD_ZERO(&fdr);
                     FD_ZERO(&fde);
                     FD_SET(sockfd, &fdr);
                     FD_SET(sockfd, &fde);
+                    rtptimeout(&rtp, &tv);
                     if(select(sockfd+1,&fdr,0,&fde,&tv) < 0)
                     {
                       fprintf(stderr, "Select problem.\n");
                       error = 1;
                       continue;
                     }
-                    i = recv(sockfd, rtpbuf, sizeof(rtpbuf), 0);
-#ifndef WINDOWSVERSION
-                    alarm(ALARMTIME);
-#endif
-                    if(i >= 12 && (unsigned char)rtpbuf[0] == (2 << 6)
-                    && rtpbuf[1] >= 96 && rtpbuf[1] <= 98)
+                    n = FD_ISSET(sockfd, &fdr) || FD_ISSET(sockfd, &fde)
+                    ? rtpreceive(sockfd, &batch) : 0;
+                    if(n > 0 && out.age)
+                      out.arrival = utctime();
+                    valid = 0;
+                    for(k = 0; k < n && !error && !stop; ++k)
                     {
-                      time_t ct;
-                      int u,v;
-                      unsigned int w;
-                      u = ((unsigned char)rtpbuf[2]<<8)+(unsigned char)rtpbuf[3];
-                      v = ((unsigned char)rtpbuf[4]<<24)+((unsigned char)rtpbuf[5]<<16)
-                      +((unsigned char)rtpbuf[6]<<8)+(unsigned char)rtpbuf[7];
-                      w = ((unsigned char)rtpbuf[8]<<24)+((unsigned char)rtpbuf[9]<<16)
-                      +((unsigned char)rtpbuf[10]<<8)+(unsigned char)rtpbuf[11];
-
-                      if(sn == 0x10000) {sn = u-1;ts=v-1;}
-                      else if(u < -30000 && sn > 30000) sn -= 0xFFFF;
-                      if(session != w || ts > v)
-                      {
+                      const char *p = batch.buf[k];
+                      int u, type = rtpheader(p, batch.len[k], &u, &w);
+
+                      MetricsRecv(out.metrics, batch.len[k]);
+                      /* the timestamp is not checked, as packets may come
+                         out of order */
+                      if(type < 96 || type > 98)
+                        fprintf(stderr, "Illegal UDP header.\n");
+                      else if(session != w)
                         fprintf(stderr, "Illegal UDP data received.\n");
-                        continue;
+                      else if(type == 98)
+                      {
+                        fprintf(stderr, "Connection closed.\n");
+                        error = 1;
                       }
-                      else if(u > sn) /* don't show out-of-order packets */
+                      else
                       {
-                        if(rtpbuf[1] == 98)
-                        {
-                          fprintf(stderr, "Connection closed.\n");
-                          error = 1;
-                          continue;
-                        }
-                        else if((rtpbuf[1] == 96)  && (i>12))
+                        ++valid;
+                        if(type == 96 && batch.len[k] > 12
+                        && rtpput(&rtp, &out, u, p+12, batch.len[k]-12,
+                        &reconnect, args.bitrate) < 0)
                         {
-                          fwrite(rtpbuf+12, (size_t)i-12, 1, stdout);
+                          fprintf(stderr, "Could not access serial device\n");
+                          stop = 1;
                         }
                       }
-                      sn = u; ts = v;
-
+                    }
+#ifndef WINDOWSVERSION
+                    if(n > 0)
+                      alarm(ALARMTIME);
+#endif
+                    if(valid && !error)
+                    {
                       /* Keep Alive */
-                      ct = time(0);
+                      time_t ct = time(0);
                       if(ct-init > 15)
                       {
                         tim += (ct-init)*1000000/TIME_RESOLUTION;
@@ -1006,12 +4464,20 @@ int main(int argc, char **argv)
                         }
                       }
                     }
-                    else if(i >= 0)
+                    if(rtpoutput(&rtp, &out, 0, &reconnect, args.bitrate) < 0)
                     {
-                      fprintf(stderr, "Illegal UDP header.\n");
-                      continue;
+                      fprintf(stderr, "Could not access serial device\n");
+                      stop = 1;
                     }
                   }
+                  if(!stop && rtpoutput(&rtp, &out, 1, &reconnect,
+                  args.bitrate) < 0)
+                    stop = 1;
+                  if(args.bitrate)
+                  {
+                    rtpstats(&rtp);
+                    outputstats(&out);
+                  }
                 }
                 /* send connection close always to allow nice session closing */
                 tim += (time(0)-init)*1000000/TIME_RESOLUTION;
@@ -1038,13 +4504,14 @@ int main(int argc, char **argv)
         }
         else if(args.data && *args.data != '%' && args.mode == RTSP)
         {
-          struct sockaddr_in local;
+          struct sockaddr_storage local;
+          struct header header;
           sockettype sockudp = 0;
-          int localport;
+          int localport = 0;
           int cseq = 1;
           socklen_t len;
 
-          if((sockudp = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+          if((sockudp = socket(their_addr.ss_family, SOCK_DGRAM, 0)) == -1)
           {
             myperror("socket");
             error = 1;
@@ -1052,11 +4519,7 @@ int main(int argc, char **argv)
           if(!stop && !error)
           {
             /* fill structure with local address information for UDP */
-            memset(&local, 0, sizeof(local));
-            local.sin_family = AF_INET;
-            local.sin_port = htons(args.udpport);
-            local.sin_addr.s_addr = htonl(INADDR_ANY);
-            len = sizeof(local);
+            len = localaddress(&local, their_addr.ss_family, args.udpport);
             /* bind() in order to get a random RTP client_port */
             if((bind(sockudp, (struct sockaddr *)&local, len)) < 0)
             {
@@ -1068,13 +4531,10 @@ int main(int argc, char **argv)
               myperror("local access failed");
               error = 1;
             }
-            else if(connect(sockfd, (struct sockaddr *)&their_addr,
-            sizeof(struct sockaddr)) == -1)
-            {
-              myperror("connect");
-              error = 1;
-            }
-            localport = ntohs(local.sin_port);
+            else
+              localport = ntohs(local.ss_family == AF_INET6
+              ? ((struct sockaddr_in6 *)&local)->sin6_port
+              : ((struct sockaddr_in *)&local)->sin_port);
           }
           if(!stop && !error)
           {
@@ -1115,69 +4575,25 @@ int main(int argc, char **argv)
               myperror("send");
               error = 1;
             }
-            else if((numbytes=recv(sockfd, buf, MAXDATASIZE-1, 0)) == -1)
-            {
-              myperror("recv");
+            else if(readheader(sockfd, &header, buf, MAXDATASIZE-1) < 0)
               error = 1;
-            }
-            else if(numbytes >= 17 && !strncmp(buf, "RTSP/1.0 200 OK\r\n", 17))
+            else if(header.status == 200)
             {
-              int serverport = 0, session = 0;
-              const char *portcheck = "server_port=";
-              const char *sessioncheck = "session: ";
-              int l = strlen(portcheck)-1;
-              int j=0;
-              for(i = 0; j != l && i < numbytes-l; ++i)
-              {
-                for(j = 0; j < l && tolower(buf[i+j]) == portcheck[j]; ++j)
-                  ;
-              }
-              if(i == numbytes-l)
+              int serverport = header.serverport, session = header.session;
+              if(!serverport)
               {
                 fprintf(stderr, "No server port number found\n");
                 stop = 1;
               }
-              else
-              {
-                i+=l;
-                while(i < numbytes && buf[i] >= '0' && buf[i] <= '9')
-                  serverport = serverport * 10 + buf[i++]-'0';
-                if(buf[i] != '\r' && buf[i] != ';')
-                {
-                  fprintf(stderr, "Could not extract server port\n");
-                  stop = 1;
-                }
-              }
-              if(!stop && !error)
+              else if(!header.hassession)
               {
-                l = strlen(sessioncheck)-1;
-                j=0;
-                for(i = 0; j != l && i < numbytes-l; ++i)
-                {
-                  for(j = 0; j < l && tolower(buf[i+j]) == sessioncheck[j]; ++j)
-                    ;
-                }
-                if(i == numbytes-l)
-                {
-                  fprintf(stderr, "No session number found\n");
-                  stop = 1;
-                }
-                else
-                {
-                  i+=l;
-                  while(i < numbytes && buf[i] >= '0' && buf[i] <= '9')
-                    session = session * 10 + buf[i++]-'0';
-                  if(buf[i] != '\r')
-                  {
-                    fprintf(stderr, "Could not extract session number\n");
-                    stop = 1;
-                  }
-                }
+                fprintf(stderr, "No session number found\n");
+                stop = 1;
               }
               if(!stop && !error && args.initudp)
               {
                 printf("Sending initial UDP packet\n");
-                struct sockaddr_in casterRTP;
+                struct sockaddr_storage casterRTP;
                 char rtpbuffer[12];
                 int i;
                 rtpbuffer[0] = (2<<6);
@@ -1196,13 +4612,11 @@ int main(int argc, char **argv)
                 rtpbuffer[10] = (session>>8)&0xFF;
                 rtpbuffer[11] = (session)&0xFF;
                 /* fill structure with caster address information for UDP */
-                memset(&casterRTP, 0, sizeof(casterRTP));
-                casterRTP.sin_family = AF_INET;
-                casterRTP.sin_port   = htons(serverport);
-                casterRTP.sin_addr   = *((struct in_addr *)he->h_addr);
+                casterRTP = their_addr;
+                setport(&casterRTP, serverport);
 
                 if((i = sendto(sockudp, rtpbuffer, 12, 0,
-                (struct sockaddr *) &casterRTP, sizeof(casterRTP))) != 12)
+                (struct sockaddr *) &casterRTP, their_len)) != 12)
                   myperror("WARNING: could not send initial UDP packet");
               }
               if(!stop && !error)
@@ -1225,13 +4639,12 @@ int main(int argc, char **argv)
                   myperror("send");
                   error = 1;
                 }
-                else if((numbytes=recv(sockfd, buf, MAXDATASIZE-1, 0)) != -1)
+                else if(readheader(sockfd, &header, buf, MAXDATASIZE-1) >= 0)
                 {
-                  if(numbytes >= 17 && !strncmp(buf, "RTSP/1.0 200 OK\r\n", 17))
+                  if(header.status == 200)
                   {
-                    int ts = 0, sn = 0;
                     time_t init = 0;
-                    struct sockaddr_in addrRTP;
+                    MetricsHandshake(out.metrics, mstime()-connectstart);
 #ifdef WINDOWSVERSION
                     u_long blockmode = 1;
                     if(ioctlsocket(sockudp, FIONBIO, &blockmode)
@@ -1245,20 +4658,13 @@ int main(int argc, char **argv)
                       error = 1;
                     }
 
-                    /* fill structure with caster address information for UDP */
-                    memset(&addrRTP, 0, sizeof(addrRTP));
-                    addrRTP.sin_family = AF_INET;
-                    addrRTP.sin_port   = htons(serverport);
-                    their_addr.sin_addr = *((struct in_addr *)he->h_addr);
-                    len = sizeof(addrRTP);
-
+                    RtpInit(&rtp, args.latency);
                     while(!stop && !error)
                     {
-                      char rtpbuffer[1526];
-                      struct timeval tv = {1,0};
+                      struct timeval tv;
                       fd_set fdr;
                       fd_set fde;
-                      int r;
+                      int r, n, k, valid = 0;
 
                       FD_ZERO(&fdr);
                       FD_ZERO(&fde);
@@ -1266,6 +4672,7 @@ int main(int argc, char **argv)
                       FD_SET(sockfd, &fdr);
                       FD_SET(sockudp, &fde);
                       FD_SET(sockfd, &fde);
+                      rtptimeout(&rtp, &tv);
                       if(select((sockudp>sockfd?sockudp:sockfd)+1,
                       &fdr,0,&fde,&tv) < 0)
                       {
@@ -1273,65 +4680,73 @@ int main(int argc, char **argv)
                         error = 1;
                         continue;
                       }
-                      i = recvfrom(sockudp, rtpbuffer, sizeof(rtpbuffer), 0,
-                      (struct sockaddr*) &addrRTP, &len);
+                      n = FD_ISSET(sockudp, &fdr) || FD_ISSET(sockudp, &fde)
+                      ? rtpreceive(sockudp, &batch) : 0;
+                      if(n > 0 && out.age)
+                        out.arrival = utctime();
+                      for(k = 0; k < n && !stop; ++k)
+                      {
+                        const char *p = batch.buf[k];
+                        unsigned int w;
+                        int u;
+
+                        MetricsRecv(out.metrics, batch.len[k]);
+                        /* the timestamp is not checked, as packets may come
+                           out of order */
+                        if(rtpheader(p, batch.len[k], &u, &w) != 0x60
+                        || batch.len[k] < 12+1)
+                          fprintf(stderr, "Illegal UDP header.\n");
+                        else if((unsigned int)session != w)
+                          fprintf(stderr, "Illegal UDP data received.\n");
+                        else
+                        {
+                          if(rtpput(&rtp, &out, u, p+12, batch.len[k]-12,
+                          &reconnect, args.bitrate) < 0)
+                          {
+                            fprintf(stderr, "Could not access serial device\n");
+                            stop = 1;
+                          }
+                          ++valid;
+                        }
+                      }
 #ifndef WINDOWSVERSION
-                      alarm(ALARMTIME);
+                      if(n > 0)
+                        alarm(ALARMTIME);
 #endif
-                      if(i >= 12+1 && (unsigned char)rtpbuffer[0] == (2 << 6) && rtpbuffer[1] == 0x60)
+                      if(valid)
                       {
-                        int u,v,w;
-                        u = ((unsigned char)rtpbuffer[2]<<8)+(unsigned char)rtpbuffer[3];
-                        v = ((unsigned char)rtpbuffer[4]<<24)+((unsigned char)rtpbuffer[5]<<16)
-                        +((unsigned char)rtpbuffer[6]<<8)+(unsigned char)rtpbuffer[7];
-                        w = ((unsigned char)rtpbuffer[8]<<24)+((unsigned char)rtpbuffer[9]<<16)
-                        +((unsigned char)rtpbuffer[10]<<8)+(unsigned char)rtpbuffer[11];
-
-                        if(init)
+                        time_t ct = time(0);
+                        if(!init)
+                          init = ct;
+                        else if(ct-init > 15)
                         {
-                          time_t ct;
-                          if(u < -30000 && sn > 30000) sn -= 0xFFFF;
-                          if(session != w || ts > v)
+                          i = snprintf(buf, MAXDATASIZE,
+                          "GET_PARAMETER rtsp://%s%s%s/%s RTSP/1.0\r\n"
+                          "CSeq: %d\r\n"
+                          "Session: %u\r\n"
+                          "\r\n",
+                          args.server, proxyserver ? ":" : "", proxyserver
+                          ? args.port : "", args.data, cseq++, session);
+                          if(i > MAXDATASIZE || i < 0)
                           {
-                            fprintf(stderr, "Illegal UDP data received.\n");
-                            continue;
+                            fprintf(stderr, "Requested data too long\n");
+                            stop = 1;
                           }
-                          else if(u > sn) /* don't show out-of-order packets */
-                            fwrite(rtpbuffer+12, (size_t)i-12, 1, stdout);
-                          ct = time(0);
-                          if(ct-init > 15)
+                          else if(send(sockfd, buf, (size_t)i, 0) != i)
                           {
-                            i = snprintf(buf, MAXDATASIZE,
-                            "GET_PARAMETER rtsp://%s%s%s/%s RTSP/1.0\r\n"
-                            "CSeq: %d\r\n"
-                            "Session: %u\r\n"
-                            "\r\n",
-                            args.server, proxyserver ? ":" : "", proxyserver
-                            ? args.port : "", args.data, cseq++, session);
-                            if(i > MAXDATASIZE || i < 0)
-                            {
-                              fprintf(stderr, "Requested data too long\n");
-                              stop = 1;
-                            }
-                            else if(send(sockfd, buf, (size_t)i, 0) != i)
-                            {
-                              myperror("send");
-                              error = 1;
-                            }
-                            init = ct;
+                            myperror("send");
+                            error = 1;
                           }
+                          init = ct;
                         }
-                        else
-                        {
-                          init = time(0);
-                        }
-                        sn = u; ts = v;
                       }
-                      else if(i >= 0)
+                      if(rtpoutput(&rtp, &out, 0, &reconnect, args.bitrate) < 0)
                       {
-                        fprintf(stderr, "Illegal UDP header.\n");
-                        continue;
+                        fprintf(stderr, "Could not access serial device\n");
+                        stop = 1;
                       }
+                      if(!FD_ISSET(sockfd, &fdr) && !FD_ISSET(sockfd, &fde))
+                        continue;
                       /* ignore RTSP server replies */
                       if((r=recv(sockfd, buf, MAXDATASIZE-1, 0)) < 0)
                       {
@@ -1351,6 +4766,14 @@ int main(int argc, char **argv)
                         error = 1;
                       }
                     }
+                    if(!stop && rtpoutput(&rtp, &out, 1, &reconnect,
+                    args.bitrate) < 0)
+                      stop = 1;
+                    if(args.bitrate)
+                    {
+                      rtpstats(&rtp);
+                      outputstats(&out);
+                    }
                   }
                   i = snprintf(buf, MAXDATASIZE,
                   "TEARDOWN rtsp://%s%s%s/%s RTSP/1.0\r\n"
@@ -1389,78 +4812,11 @@ int main(int argc, char **argv)
         }
         else
         {
-          if(connect(sockfd, (struct sockaddr *)&their_addr,
-          sizeof(struct sockaddr)) == -1)
-          {
-            myperror("connect");
-            error = 1;
-          }
           if(!stop && !error)
           {
-            if(!args.data)
-            {
-              i = snprintf(buf, MAXDATASIZE,
-              "GET %s%s%s%s/ HTTP/1.1\r\n"
-              "Host: %s\r\n%s"
-              "User-Agent: %s/%s\r\n"
-              "Connection: close\r\n"
-              "\r\n"
-              , proxyserver ? "http://" : "", proxyserver ? proxyserver : "",
-              proxyserver ? ":" : "", proxyserver ? proxyport : "",
-              args.server, args.mode == NTRIP1 ? "" : "Ntrip-Version: Ntrip/2.0\r\n",
-              AGENTSTRING, revisionstr);
-            }
-            else
-            {
-              const char *nmeahead = (args.nmea && args.mode == HTTP) ? args.nmea : 0;
-
-              i=snprintf(buf, MAXDATASIZE-40, /* leave some space for login */
-              "GET %s%s%s%s/%s HTTP/1.1\r\n"
-              "Host: %s\r\n%s"
-              "User-Agent: %s/%s\r\n"
-              "%s%s%s"
-              "Connection: close%s"
-              , proxyserver ? "http://" : "", proxyserver ? proxyserver : "",
-              proxyserver ? ":" : "", proxyserver ? proxyport : "",
-              args.data, args.server,
-              args.mode == NTRIP1 ? "" : "Ntrip-Version: Ntrip/2.0\r\n",
-              AGENTSTRING, revisionstr,
-              nmeahead ? "Ntrip-GGA: " : "", nmeahead ? nmeahead : "",
-              nmeahead ? "\r\n" : "",
-              (*args.user || *args.password) ? "\r\nAuthorization: Basic " : "");
-              if(i > MAXDATASIZE-40 || i < 0) /* second check for old glibc */
-              {
-                fprintf(stderr, "Requested data too long\n");
-                stop = 1;
-              }
-              else
-              {
-                i += encode(buf+i, MAXDATASIZE-i-4, args.user, args.password);
-                if(i > MAXDATASIZE-4)
-                {
-                  fprintf(stderr, "Username and/or password too long\n");
-                  stop = 1;
-                }
-                else
-                {
-                  buf[i++] = '\r';
-                  buf[i++] = '\n';
-                  buf[i++] = '\r';
-                  buf[i++] = '\n';
-                  if(args.nmea && !nmeahead)
-                  {
-                    int j = snprintf(buf+i, MAXDATASIZE-i, "%s\r\n", args.nmea);
-                    if(j >= 0 && j < MAXDATASIZE-i)
-                      i += j;
-                    else
-                    {
-                      fprintf(stderr, "NMEA string too long\n");
-                      stop = 1;
-                    }
-                  }
-                }
-              }
-            }
+            if((i = buildrequest(buf, MAXDATASIZE, &args, proxyserver,
+            proxyport)) < 0)
+              stop = 1;
           }
           if(!stop && !error)
           {
@@ -1471,229 +4827,175 @@ int main(int argc, char **argv)
             }
             else if(args.data && *args.data != '%')
             {
-              int k = 0;
-              int chunkymode = 0;
+              struct header header;
+              int spliced = 0, trysplice = 0, drained = 1;
+              struct chunky chunky = {0, 0};
               int starttime = time(0);
               int lastout = starttime;
               int totalbytes = 0;
-              int chunksize = 0;
 
-              while(!stop && !error &&
-              (numbytes=recv(sockfd, buf, MAXDATASIZE-1, 0)) > 0)
+#ifdef HAVE_HANDOVER
+              /* the rover position comes from the serial device and the
+                 epochs are found by the RTCM3 filter */
+              int canhandover = args.nearest && out.serial && out.rtcm3;
+              unsigned long fixes = nmea.fixes;
+
+              handover.lastdata = 0;
+#endif
+
+              headerinit(&header);
+              while(!stop && !error)
               {
-#ifndef WINDOWSVERSION
-                alarm(ALARMTIME);
+                i = 0;
+                outputwait(&out, sockfd, drained);
+#ifdef HAVE_HANDOVER
+                if(out.epochend)
+                  i = 3;
+                else if(handover.state != HO_OFF)
+                  i = handoverwait(&handover, sockfd, out.serial ? &sx : 0,
+                  &nmea, ser);
+                else
 #endif
-                if(!k)
+                if(out.serial)
+                  i = waitsocket(sockfd, &sx, &nmea, ser);
+#ifdef HAVE_HANDOVER
+                if(i == 3 || i == 4)
                 {
-                  buf[numbytes] = 0; /* latest end mark for strstr */
-                  if( numbytes > 17 &&
-                    !strstr(buf, "ICY 200 OK")  &&  /* case 'proxy & ntrip 1.0 caster' */
-                    (!strncmp(buf, "HTTP/1.1 200 OK\r\n", 17) ||
-                    !strncmp(buf, "HTTP/1.0 200 OK\r\n", 17)) )
-                  {
-                    const char *datacheck = "Content-Type: gnss/data\r\n";
-                    const char *chunkycheck = "Transfer-Encoding: chunked\r\n";
-                    int l = strlen(datacheck)-1;
-                    int j=0;
-                    for(i = 0; j != l && i < numbytes-l; ++i)
-                    {
-                      for(j = 0; j < l && buf[i+j] == datacheck[j]; ++j)
-                        ;
-                    }
-                    if(i == numbytes-l)
-                    {
-                      fprintf(stderr, "No 'Content-Type: gnss/data' found\n");
-                      error = 1;
-                    }
-                    l = strlen(chunkycheck)-1;
-                    j=0;
-                    for(i = 0; j != l && i < numbytes-l; ++i)
-                    {
-                      for(j = 0; j < l && buf[i+j] == chunkycheck[j]; ++j)
-                        ;
-                    }
-                    if(i < numbytes-l)
-                      chunkymode = 1;
-                  }
-                  else if(!strstr(buf, "ICY 200 OK"))
-                  {
-                    fprintf(stderr, "Could not get the requested data: ");
-                    for(k = 0; k < numbytes && buf[k] != '\n' && buf[k] != '\r'; ++k)
-                    {
-                      fprintf(stderr, "%c", isprint(buf[k]) ? buf[k] : '.');
-                    }
-                    fprintf(stderr, "\n");
-                    error = 1;
-                  }
-                  else if(args.mode != NTRIP1)
+                  if((i == 3 ? handovernearest(&handover, &out, &nearest, &args,
+                  &sockfd, &chunky) : standbyswitch(&handover, &streams, &out,
+                  &args, &sockfd, &chunky)) < 0)
                   {
-                    fprintf(stderr, "NTRIP version 2 HTTP connection failed%s.\n",
-                    args.mode == AUTO ? ", falling back to NTRIP1" : "");
-                    if(args.mode == HTTP)
-                      stop = 1;
+                    fprintf(stderr, "Could not access serial device\n");
+                    stop = 1;
                   }
-                  k = 1;
-                  if(args.mode == NTRIP1)
-                    continue; /* skip old headers for NTRIP1 */
+                  outputflush(&out);
+                  continue;
+                }
+                if(canhandover && header.done && nmea.fixes != fixes)
+                {
+                  fixes = nmea.fixes;
+                  handovercheck(&handover, &args, &nearest, nmea.lat, nmea.lon);
+                }
+                else if(streams.num > 1 && header.done
+                && handover.state == HO_OFF && mstime() >= handover.retry)
+                  standbystart(&handover, &streams);
+                out.cutepoch = handover.ready != 0;
+#endif
+                if(i)
+                {
+                  if(i == 2)
+                    stop = 1;
                   else
-                  {
-                    char *ep = strstr(buf, "\r\n\r\n");
-                    if(!ep || ep+4 == buf+numbytes)
-                      continue;
-                    ep += 4;
-                    memmove(buf, ep, numbytes-(ep-buf));
-                    numbytes -= (ep-buf);
-                  }
+                    error = 1;
+                  break;
                 }
-                sleeptime = 0;
-                if(chunkymode)
+#ifdef HAVE_SPLICE
+                if(spliced)
                 {
-                  int cstop = 0;
-                  int pos = 0;
-                  while(!stop && !cstop && !error && pos < numbytes)
+                  int failed = 0;
+                  numbytes = splicedata(sockfd, fileno(stdout), splicepipe,
+                  &failed);
+                  if(failed)
                   {
-                    switch(chunkymode)
+                    /* stdout takes no spliced data, recv() is used again and
+                       reports the errors of the socket */
+                    trysplice = 0;
+                    if(numbytes < 0)
                     {
-                    case 1: /* reading number starts */
-                      chunksize = 0;
-                      ++chunkymode; /* no break */
-                    case 2: /* during reading number */
-                      i = buf[pos++];
-                      if(i >= '0' && i <= '9') chunksize = chunksize*16+i-'0';
-                      else if(i >= 'a' && i <= 'f') chunksize = chunksize*16+i-'a'+10;
-                      else if(i >= 'A' && i <= 'F') chunksize = chunksize*16+i-'A'+10;
-                      else if(i == '\r') ++chunkymode;
-                      else if(i == ';') chunkymode = 5;
-                      else cstop = 1;
-                      break;
-                    case 3: /* scanning for return */
-                      if(buf[pos++] == '\n') chunkymode = chunksize ? 4 : 1;
-                      else cstop = 1;
-                      break;
-                    case 4: /* output data */
-                      i = numbytes-pos;
-                      if(i > chunksize) i = chunksize;
-                      if(args.serdevice)
-                      {
-                        int ofs = 0;
-                        while(i > ofs && !cstop && !stop && !error)
-                        {
-                          int j = SerialWrite(&sx, buf+pos+ofs, i-ofs);
-                          if(j < 0)
-                          {
-                            fprintf(stderr, "Could not access serial device\n");
-                            stop = 1;
-                          }
-                          else
-                            ofs += j;
-                        }
-                      }
-                      else
-                        fwrite(buf+pos, (size_t)i, 1, stdout);
-                      totalbytes += i;
-                      chunksize -= i;
-                      pos += i;
-                      if(!chunksize)
-                        chunkymode = 1;
-                      break;
-                    case 5:
-                      if(i == '\r') chunkymode = 3;
-                      break;
+                      spliced = 0;
+                      continue;
                     }
                   }
-                  if(cstop)
-                  {
-                    fprintf(stderr, "Error in chunky transfer encoding\n");
-                    error = 1;
-                  }
                 }
                 else
+                  numbytes = recv(sockfd, buf, MAXDATASIZE-1, 0);
+                if(numbytes <= 0)
+#else
+                if((numbytes=recv(sockfd, buf, MAXDATASIZE-1, 0)) <= 0)
+#endif
                 {
-                  totalbytes += numbytes;
-                  if(args.serdevice)
+#ifdef HAVE_HANDOVER
+                  /* the standby stream takes over at once */
+                  if(handover.standby >= 0 && handover.state == HO_DATA)
                   {
-                    int ofs = 0;
-                    while(numbytes > ofs && !stop)
+                    handover.lastdata = 0;
+                    if(standbyswitch(&handover, &streams, &out, &args,
+                    &sockfd, &chunky) < 0)
                     {
-                      int i = SerialWrite(&sx, buf+ofs, numbytes-ofs);
-                      if(i < 0)
-                      {
-                        fprintf(stderr, "Could not access serial device\n");
-                        stop = 1;
-                      }
-                      else
-                        ofs += i;
+                      fprintf(stderr, "Could not access serial device\n");
+                      stop = 1;
                     }
+                    continue;
                   }
-                  else
-                    fwrite(buf, (size_t)numbytes, 1, stdout);
-                }
-                fflush(stdout);
-                if(totalbytes < 0) /* overflow */
-                {
-                  totalbytes = 0;
-                  starttime = time(0);
-                  lastout = starttime;
+#endif
+                  break;
                 }
-                if(args.serdevice && !stop)
+                drained = numbytes < MAXDATASIZE-1;
+#ifndef WINDOWSVERSION
+                alarm(ALARMTIME);
+#endif
+#ifdef HAVE_HANDOVER
+                handoverarrival(&handover);
+#endif
+                if(out.age)
+                  out.arrival = utctime();
+                MetricsRecv(out.metrics, numbytes);
+                if(!header.done)
                 {
-                  int doloop = 1;
-                  while(doloop && !stop)
+                  if((i = checkheader(&header, buf, &numbytes, args.mode,
+                  &chunky)))
                   {
-                    int i = SerialRead(&sx, buf, 200);
-                    if(i < 0)
-                    {
-                      fprintf(stderr, "Could not access serial device\n");
+                    if(i == 2)
                       stop = 1;
-                    }
                     else
-                    {
-                      int j = 0;
-                      if(i < 200) doloop = 0;
-                      fwrite(buf, i, 1, stdout);
-                      if(ser)
-                        fwrite(buf, i, 1, ser);
-                      while(j < i)
-                      {
-                        if(nmeabufpos < 6)
-                        {
-                          if(nmeabuffer[nmeabufpos] != buf[j])
-                          {
-                            if(nmeabufpos) nmeabufpos = 0;
-                            else ++j;
-                          }
-                          else
-                          {
-                            nmeastarpos = 0;
-                            ++j; ++nmeabufpos;
-                          }
-                        }
-                        else if((nmeastarpos && nmeabufpos == nmeastarpos + 3)
-                        || buf[j] == '\r' || buf[j] == '\n')
-                        {
-                          doloop = 0;
-                          nmeabuffer[nmeabufpos++] = '\r';
-                          nmeabuffer[nmeabufpos++] = '\n';
-                          if(send(sockfd, nmeabuffer, nmeabufpos, 0)
-                          != (int)nmeabufpos)
-                          {
-                            fprintf(stderr, "Could not send NMEA\n");
-                            error = 1;
-                          }
-                          nmeabufpos = 0;
-                        }
-                        else if(nmeabufpos > sizeof(nmeabuffer)-10 ||
-                        buf[j] == '$')
-                          nmeabufpos = 0;
-                        else
-                        {
-                          if(buf[j] == '*') nmeastarpos = nmeabufpos;
-                          nmeabuffer[nmeabufpos++] = buf[j++];
-                        }
-                      }
-                    }
+                      error = 1;
+                    continue;
                   }
+#ifdef HAVE_SPLICE
+                  trysplice = header.done && !chunky.mode && !out.serial
+                  && !out.rtcm3 && !out.fanout && !args.numstandby
+                  && cansplice(fileno(stdout));
+#endif
+                  if(header.done)
+                    MetricsHandshake(out.metrics, mstime()-connectstart);
+                  if(!numbytes)
+                    continue;
+                }
+                if(reconnectdata(&reconnect) > 0 && args.bitrate)
+                  reconnectstats(0, &reconnect);
+                if(chunky.mode && (numbytes = dechunk(&chunky, buf, numbytes)) < 0)
+                {
+                  fprintf(stderr, "Error in chunky transfer encoding\n");
+                  MetricsChunkError(out.metrics);
+                  error = 1;
+                  continue;
+                }
+                totalbytes += numbytes;
+                if(!spliced && outputdata(&out, buf, numbytes) < 0)
+                {
+                  fprintf(stderr, "Could not access serial device\n");
+                  stop = 1;
+                }
+                if(drained)
+                  outputdrained(&out);
+#ifdef HAVE_SPLICE
+                if(spliced && !trysplice)
+                  spliced = 0;
+                else if(trysplice && !spliced)
+                {
+                  /* further data goes from the socket directly to stdout */
+                  struct stat st;
+                  outputflush(&out);
+                  fstat(fileno(stdout), &st);
+                  spliced = S_ISFIFO(st.st_mode) || splicepipe[0] != -1
+                  || !pipe(splicepipe);
+                }
+#endif
+                if(totalbytes < 0) /* overflow */
+                {
+                  totalbytes = 0;
+                  starttime = time(0);
+                  lastout = starttime;
                 }
                 if(args.bitrate)
                 {
@@ -1703,13 +5005,44 @@ int main(int argc, char **argv)
                     lastout = t;
                     fprintf(stderr, "Bitrate is %dbyte/s (%d seconds accumulated).\n",
                     totalbytes/(t-starttime), t-starttime);
+                    reconnectstats(0, &reconnect);
+                    if(out.rtcm3)
+                      fprintf(stderr, "RTCM3: %lu frames, %lu checksum errors, "
+                      "%lu bytes skipped.\n", out.rtcm3->frames,
+                      out.rtcm3->crcerrors, out.rtcm3->skipped);
+                    outputstats(&out);
+#ifdef HAVE_SERIALQUEUE
+                    if(out.queue)
+                      fprintf(stderr, "Serial queue: %lu blocks (%lu bytes) dropped, %lu blocks (%lu bytes) too old.\n",
+                      out.queue->dropped, out.queue->droppedbytes,
+                      atomic_load(&out.queue->stale),
+                      atomic_load(&out.queue->stalebytes));
+                    if(out.queue && atomic_load(&out.queue->delivered))
+                      fprintf(stderr, "Serial delivery: %lu blocks, %.1f ms mean, %lu ms max from arrival until sent.\n",
+                      atomic_load(&out.queue->delivered),
+                      (double)atomic_load(&out.queue->deliveryms)
+                      /atomic_load(&out.queue->delivered),
+                      atomic_load(&out.queue->maxdeliveryms));
+#endif
+#ifdef HAVE_FANOUT
+                    if(out.fanout)
+                      fanoutstats(out.fanout);
+#endif
                   }
                 }
               }
+#ifdef HAVE_HANDOVER
+              handoverstop(&handover, 0);
+              out.cutepoch = out.epochend = 0;
+#endif
+            }
+            else if(args.stcache)
+            {
+              if(fetchsourcetable(sockfd, &args))
+                error = 1;
             }
             else
             {
-              sleeptime = 0;
               while(!stop && (numbytes=recv(sockfd, buf, MAXDATASIZE-1, 0)) > 0)
               {
   #ifndef WINDOWSVERSION
@@ -1721,16 +5054,47 @@ int main(int argc, char **argv)
           }
         }
       }
+#ifndef WINDOWSVERSION
+      alarmsocket = -1;
+#endif
       if(sockfd)
         closesocket(sockfd);
-      sleep(10);
-    } while(args.data && *args.data != '%' && !stop);
+      if(!stop)
+      {
+        reconnectlost(&reconnect);
+        MetricsReconnect(out.metrics);
+      }
+    } while((args.nearest || (args.data && *args.data != '%')) && !stop);
+    nearestfree(&nearest);
+#ifdef HAVE_MERGE
+    if(out.merge)
+      mergestop(&merge);
+#endif
+#ifdef HAVE_FANOUT
+    if(out.fanout)
+      FanoutStop(out.fanout);
+#endif
+#ifdef HAVE_METRICS
+    if(out.metrics)
+      MetricsStop(&metricsserver);
+#endif
     if(args.serdevice)
     {
+#ifdef HAVE_SERIALQUEUE
+      if(out.queue)
+        SerialQueueStop(out.queue);
+#endif
       SerialFree(&sx);
     }
     if(ser)
       fclose(ser);
+#ifdef HAVE_SPLICE
+    if(splicepipe[0] != -1)
+    {
+      close(splicepipe[0]);
+      close(splicepipe[1]);
+    }
+#endif
   }
   return 0;
 }
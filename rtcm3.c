@@ -0,0 +1,481 @@
+/*
+  RTCM3 frame handling for NTRIP client for POSIX.
+  $Id$
+  Copyright (C) 2026 by the ntripclient contributors
+  <https://github.com/nunojpg/ntripclient>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+  or read http://www.gnu.org/licenses/gpl.txt
+*/
+
+/* system includes */
+#include <stdlib.h>
+#include <string.h>
+
+/* An RTCM3 frame is the preamble 0xD3, 6 reserved bits, a 10 bit length,
+   up to 1023 bytes of message and a 24 bit CRC (CRC-24Q). */
+#define RTCM3PREAMBLE   0xD3
+#define RTCM3MAXFRAME   (1023+6)
+#define RTCM3CRCPOLY    0x864CFBUL
+
+struct rtcm3
+{
+  unsigned char buf[RTCM3MAXFRAME]; /* frames split between inputs */
+  int           start;
+  int           end;
+  unsigned long frames;    /* valid frames */
+  unsigned long crcerrors; /* frames with wrong checksum */
+  unsigned long skipped;   /* bytes not belonging to a valid frame */
+};
+
+/* CRC-24Q tables for slicing-by-8, the CRC is kept in the upper 24 bits */
+static unsigned long rtcm3crctab[8][256];
+
+static void Rtcm3Init(void)
+{
+  unsigned long c;
+  int i, j;
+
+  if(rtcm3crctab[0][1])
+    return;
+  for(i = 0; i < 256; ++i)
+  {
+    c = (unsigned long)i << 24;
+    for(j = 0; j < 8; ++j)
+      c = ((c << 1) ^ ((c & 0x80000000UL) ? RTCM3CRCPOLY << 8 : 0))
+      & 0xFFFFFFFFUL;
+    rtcm3crctab[0][i] = c;
+  }
+  for(i = 0; i < 256; ++i)
+  {
+    for(j = 1; j < 8; ++j)
+      rtcm3crctab[j][i] = ((rtcm3crctab[j-1][i] << 8)
+      ^ rtcm3crctab[0][rtcm3crctab[j-1][i] >> 24]) & 0xFFFFFFFFUL;
+  }
+}
+
+/* returns the CRC-24Q of the data, Rtcm3Init() must be called before */
+static unsigned long Rtcm3CRC(const unsigned char *buf, size_t size)
+{
+  unsigned long crc = 0, a, b;
+
+  while(size >= 8)
+  {
+    a = crc ^ (((unsigned long)buf[0] << 24) | ((unsigned long)buf[1] << 16)
+    | ((unsigned long)buf[2] << 8) | buf[3]);
+    b = ((unsigned long)buf[4] << 24) | ((unsigned long)buf[5] << 16)
+    | ((unsigned long)buf[6] << 8) | buf[7];
+    crc = rtcm3crctab[7][a >> 24] ^ rtcm3crctab[6][(a >> 16) & 0xFF]
+    ^ rtcm3crctab[5][(a >> 8) & 0xFF] ^ rtcm3crctab[4][a & 0xFF]
+    ^ rtcm3crctab[3][b >> 24] ^ rtcm3crctab[2][(b >> 16) & 0xFF]
+    ^ rtcm3crctab[1][(b >> 8) & 0xFF] ^ rtcm3crctab[0][b & 0xFF];
+    buf += 8;
+    size -= 8;
+  }
+  while(size--)
+    crc = ((crc << 8) ^ rtcm3crctab[0][(crc >> 24) ^ *(buf++)]) & 0xFFFFFFFFUL;
+  return crc >> 8;
+}
+
+/* returns the frame size for a frame header, 0 for an invalid header */
+static int Rtcm3FrameSize(const unsigned char *buf)
+{
+  if(buf[0] != RTCM3PREAMBLE || (buf[1] & 0xFC))
+    return 0;
+  return (((buf[1] & 0x03) << 8) | buf[2]) + 6;
+}
+
+/* the CRC over a complete frame including its checksum is 0 */
+static int Rtcm3FrameValid(const unsigned char *buf, int size)
+{
+  return !Rtcm3CRC(buf, size);
+}
+
+static void Rtcm3Reset(struct rtcm3 *r)
+{
+  Rtcm3Init();
+  r->skipped += r->end - r->start;
+  r->start = r->end = 0;
+}
+
+/* Searches the next valid frame. *buf and *size are advanced over the
+   consumed input. Returns the frame size and sets *frame, which points
+   either into the input or into the internal buffer and stays valid until
+   the next call. Returns 0 when all input is consumed. */
+static int Rtcm3Next(struct rtcm3 *r, const char **buf, int *size,
+const unsigned char **frame)
+{
+  const unsigned char *in = (const unsigned char *)*buf;
+  int left = *size, res = 0;
+
+  while(!res)
+  {
+    if(r->start == r->end)
+    {
+      const unsigned char *p = memchr(in, RTCM3PREAMBLE, left);
+      int n;
+      if(!p)
+      {
+        r->skipped += left;
+        in += left;
+        left = 0;
+        break;
+      }
+      r->skipped += p-in;
+      left -= p-in;
+      in = p;
+      if(left >= 3 && !(n = Rtcm3FrameSize(in)))
+      {
+        ++r->skipped; ++in; --left;
+      }
+      else if(left >= 3 && left >= n)
+      {
+        if(Rtcm3FrameValid(in, n))
+        {
+          *frame = in;
+          res = n;
+          in += n;
+          left -= n;
+        }
+        else
+        {
+          ++r->crcerrors;
+          ++r->skipped; ++in; --left;
+        }
+      }
+      else
+      {
+        /* frame continues in next input */
+        memcpy(r->buf, in, left);
+        r->start = 0;
+        r->end = left;
+        in += left;
+        left = 0;
+        break;
+      }
+    }
+    else
+    {
+      /* bytes from earlier input are checked first */
+      unsigned char *p = r->buf+r->start;
+      int avail = r->end-r->start, n, need;
+      if(*p != RTCM3PREAMBLE)
+      {
+        unsigned char *q = memchr(p, RTCM3PREAMBLE, avail);
+        n = q ? q-p : avail;
+        r->skipped += n;
+        r->start += n;
+        continue;
+      }
+      need = avail < 3 ? 3 : (n = Rtcm3FrameSize(p));
+      if(!need)
+      {
+        ++r->skipped; ++r->start;
+        continue;
+      }
+      if(avail < need)
+      {
+        if(!left)
+          break;
+        if(r->start)
+        {
+          memmove(r->buf, p, avail);
+          r->start = 0;
+          r->end = avail;
+        }
+        n = need-avail < left ? need-avail : left;
+        memcpy(r->buf+r->end, in, n);
+        r->end += n;
+        in += n;
+        left -= n;
+        continue;
+      }
+      if(Rtcm3FrameValid(p, need))
+      {
+        *frame = p;
+        res = need;
+        r->start += need;
+      }
+      else
+      {
+        ++r->crcerrors;
+        ++r->skipped; ++r->start;
+      }
+    }
+    if(r->start == r->end)
+      r->start = r->end = 0;
+  }
+  if(res)
+    ++r->frames;
+  *buf = (const char *)in;
+  *size = left;
+  return res;
+}
+
+/* The rest looks into the messages, programs which need only the frames
+   define RTCM3FRAMESONLY. */
+#ifndef RTCM3FRAMESONLY
+/* returns the message number of a frame, 0 for an empty frame */
+static int Rtcm3Type(const unsigned char *frame, int size)
+{
+  return size >= 8 ? (frame[3] << 4) | (frame[4] >> 4) : 0;
+}
+
+/* The age of corrections is the arrival time minus the epoch time of the
+   observation messages. GPS time is ahead of UTC by the leap seconds,
+   BeiDou time is 14 seconds behind GPS time and GLONASS time is UTC plus
+   3 hours. For each message type the latest ages are kept. */
+#ifndef GPSUTCLEAP
+#define GPSUTCLEAP      18             /* seconds since 2017-01-01 */
+#endif
+#define RTCM3GPSEPOCH   315964800000LL /* 1980-01-06 in ms since 1970 */
+#define RTCM3WEEK       604800000L     /* ms */
+#define RTCM3DAY        86400000L
+#define RTCM3AGETYPES   16
+#define RTCM3AGESAMPLES 256
+
+struct rtcm3agetype
+{
+  int           type;
+  int           num;      /* valid samples */
+  int           pos;      /* next sample written */
+  unsigned long count;    /* all samples */
+  double        sum;      /* ms */
+  long          sample[RTCM3AGESAMPLES]; /* ms */
+};
+
+struct rtcm3age
+{
+  struct rtcm3agetype t[RTCM3AGETYPES];
+  int                 types;
+};
+
+/* returns len bits starting at bit pos of the message */
+static unsigned long Rtcm3Bits(const unsigned char *msg, int pos, int len)
+{
+  unsigned long res = 0;
+
+  for(; len > 0; ++pos, --len)
+    res = (res << 1) | ((msg[pos >> 3] >> (7 - (pos & 7))) & 1);
+  return res;
+}
+
+/* Returns the epoch time in ms for observation messages and sets *system
+   to 'G' for time of GPS week (also Galileo, QZSS, SBAS, NavIC), 'C' for
+   time of BeiDou week and 'R' for time of GLONASS day. Returns -1 for
+   other messages. */
+static long Rtcm3Epoch(const unsigned char *frame, int size, int *system)
+{
+  int type = Rtcm3Type(frame, size);
+  const unsigned char *msg = frame+3;
+
+  if(size < 3+8+3)
+    return -1;
+  if(type >= 1001 && type <= 1004)
+  {
+    *system = 'G';
+    return Rtcm3Bits(msg, 24, 30);
+  }
+  if(type >= 1009 && type <= 1012)
+  {
+    *system = 'R';
+    return Rtcm3Bits(msg, 24, 27);
+  }
+  /* multiple signal messages MSM1 to MSM7 */
+  if(type >= 1071 && type <= 1137 && type % 10 >= 1 && type % 10 <= 7)
+  {
+    switch(type / 10)
+    {
+    case 108: /* GLONASS, day of week and time of day */
+      *system = 'R';
+      return Rtcm3Bits(msg, 27, 27);
+    case 112:
+      *system = 'C';
+      break;
+    default:
+      *system = 'G';
+      break;
+    }
+    return Rtcm3Bits(msg, 24, 30);
+  }
+  return -1;
+}
+
+/* Returns 1 for the last observation message of an epoch, where the
+   multiple message bit (synchronous GNSS flag of the legacy messages) is
+   cleared, 0 for other observation messages and -1 for messages without
+   observations. */
+static int Rtcm3EpochEnd(const unsigned char *frame, int size)
+{
+  int type = Rtcm3Type(frame, size), bit = 54;
+
+  if(size < 3+7+3)
+    return -1;
+  if(type >= 1009 && type <= 1012)
+    bit = 51;
+  else if(!(type >= 1001 && type <= 1004) && !(type >= 1071 && type <= 1137
+  && type % 10 >= 1 && type % 10 <= 7))
+    return -1;
+  return !Rtcm3Bits(frame+3, bit, 1);
+}
+
+/* sets *age to the ms an observation message arriving at the UTC time
+   given in ms since 1970 is behind its epoch, returns 0 for other
+   messages */
+static int Rtcm3FrameAge(const unsigned char *frame, int size,
+double arrival, long *age)
+{
+  long epoch, period = RTCM3WEEK;
+  int system;
+
+  if((epoch = Rtcm3Epoch(frame, size, &system)) < 0)
+    return 0;
+  if(system == 'R')
+  {
+    *age = ((long long)arrival + 3*3600000LL) % RTCM3DAY - epoch;
+    period = RTCM3DAY;
+  }
+  else
+  {
+    long long gps = (long long)arrival - RTCM3GPSEPOCH + GPSUTCLEAP*1000LL;
+    if(system == 'C')
+      gps -= 14000;
+    *age = gps % RTCM3WEEK - epoch;
+  }
+  /* arrival and epoch may lie in different weeks or days */
+  if(*age > period/2)
+    *age -= period;
+  else if(*age < -period/2)
+    *age += period;
+  return 1;
+}
+
+/* Adds the age of an observation message arriving at the UTC time given
+   in ms since 1970. Returns the age in ms or -1 for other messages. */
+static long Rtcm3Age(struct rtcm3age *a, const unsigned char *frame,
+int size, double arrival)
+{
+  struct rtcm3agetype *t = 0;
+  long age;
+  int type, i;
+
+  if(!Rtcm3FrameAge(frame, size, arrival, &age))
+    return -1;
+  type = Rtcm3Type(frame, size);
+  for(i = 0; i < a->types && !t; ++i)
+  {
+    if(a->t[i].type == type)
+      t = &a->t[i];
+  }
+  if(!t)
+  {
+    if(a->types == RTCM3AGETYPES)
+      return age;
+    t = &a->t[a->types++];
+    memset(t, 0, sizeof(*t));
+    t->type = type;
+  }
+  t->sample[t->pos] = age;
+  t->pos = (t->pos+1) % RTCM3AGESAMPLES;
+  if(t->num < RTCM3AGESAMPLES)
+    ++t->num;
+  ++t->count;
+  t->sum += age;
+  return age;
+}
+
+static int Rtcm3AgeCompare(const void *a, const void *b)
+{
+  long x = *(const long *)a, y = *(const long *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* fills p with the percentiles in q (0 to 1) of the latest ages in ms */
+static void Rtcm3AgePercentiles(const struct rtcm3agetype *t,
+const double *q, long *p, int num)
+{
+  long s[RTCM3AGESAMPLES];
+  int i;
+
+  memcpy(s, t->sample, t->num*sizeof(*s));
+  qsort(s, t->num, sizeof(*s), Rtcm3AgeCompare);
+  for(i = 0; i < num; ++i)
+  {
+    int j = (int)(q[i]*t->num);
+    p[i] = t->num ? s[j < t->num ? j : t->num-1] : 0;
+  }
+}
+
+/* The messages of an epoch are gathered until the observation message
+   with the multiple message bit cleared arrives, so the whole epoch can
+   be written at once. Messages without observations in between stay in
+   their place. For each complete epoch the time from its first to its
+   last message and the time from the epoch until it was complete are
+   summed up. */
+#define RTCM3EPOCHMAX 16384
+
+struct rtcm3epoch
+{
+  unsigned char buf[RTCM3EPOCHMAX];
+  int           size;          /* 0 while no epoch is gathered */
+  int           done;          /* the last message was added */
+  double        first;         /* UTC ms when the first message arrived */
+  long          completion;    /* ms from the epoch until it was complete */
+  unsigned long complete;
+  unsigned long incomplete;    /* epochs written without their end */
+  double        assembly;      /* ms, sum over the complete epochs */
+  double        maxassembly;
+  double        completionsum; /* ms */
+  long          maxcompletion;
+};
+
+/* returns 1 when a frame of size bytes does not fit any more */
+static int Rtcm3EpochFull(const struct rtcm3epoch *e, int size)
+{
+  return e->size && e->size + size > RTCM3EPOCHMAX;
+}
+
+/* adds a frame arriving at the UTC time given in ms since 1970, end is
+   the result of Rtcm3EpochEnd(), returns 1 when the epoch is complete */
+static int Rtcm3EpochPut(struct rtcm3epoch *e, const unsigned char *frame,
+int size, int end, double arrival)
+{
+  if(!e->size)
+    e->first = arrival;
+  memcpy(e->buf+e->size, frame, size);
+  e->size += size;
+  if(end != 1)
+    return 0;
+  e->done = 1;
+  ++e->complete;
+  e->assembly += arrival - e->first;
+  if(arrival - e->first > e->maxassembly)
+    e->maxassembly = arrival - e->first;
+  if(!Rtcm3FrameAge(frame, size, arrival, &e->completion))
+    e->completion = 0;
+  e->completionsum += e->completion;
+  if(e->completion > e->maxcompletion)
+    e->maxcompletion = e->completion;
+  return 1;
+}
+
+/* empties the buffer after its content was written */
+static void Rtcm3EpochClear(struct rtcm3epoch *e)
+{
+  if(e->size && !e->done)
+    ++e->incomplete;
+  e->size = e->done = 0;
+}
+#endif /* RTCM3FRAMESONLY */
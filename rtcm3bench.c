@@ -0,0 +1,300 @@
+/*
+  Benchmark for the RTCM3 frame handling of the NTRIP client for POSIX.
+  $Id$
+  Copyright (C) 2026 by the ntripclient contributors
+  <https://github.com/nunojpg/ntripclient>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+  or read http://www.gnu.org/licenses/gpl.txt
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rtcm3.c"
+
+#define BENCHSIZE (64*1024*1024)
+
+static double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+/* bitwise CRC-24Q as reference */
+static unsigned long crcbitwise(const unsigned char *buf, size_t size)
+{
+  unsigned long crc = 0;
+  int i;
+  while(size--)
+  {
+    crc ^= (unsigned long)*(buf++) << 16;
+    for(i = 0; i < 8; ++i)
+    {
+      crc <<= 1;
+      if(crc & 0x1000000UL)
+        crc ^= RTCM3CRCPOLY;
+    }
+  }
+  return crc & 0xFFFFFFUL;
+}
+
+/* bytewise table CRC-24Q for comparison */
+static unsigned long crcbytewise(const unsigned char *buf, size_t size)
+{
+  unsigned long crc = 0;
+  while(size--)
+    crc = ((crc << 8) ^ rtcm3crctab[0][(crc >> 24) ^ *(buf++)]) & 0xFFFFFFFFUL;
+  return crc >> 8;
+}
+
+/* fills buf with frames of MSM7 like sizes, returns the number of frames */
+static int makeframes(unsigned char *buf, int size, int *used)
+{
+  int pos = 0, num = 0, i;
+  for(;;)
+  {
+    int len = 100 + rand() % 700;
+    unsigned long crc;
+    if(pos+len+6 > size)
+      break;
+    buf[pos] = RTCM3PREAMBLE;
+    buf[pos+1] = len >> 8;
+    buf[pos+2] = len & 0xFF;
+    buf[pos+3] = 1077 >> 4;
+    buf[pos+4] = (1077 & 0xF) << 4;
+    for(i = 5; i < len+3; ++i)
+      buf[pos+i] = rand();
+    crc = Rtcm3CRC(buf+pos, len+3);
+    buf[pos+len+3] = crc >> 16;
+    buf[pos+len+4] = crc >> 8;
+    buf[pos+len+5] = crc;
+    pos += len+6;
+    ++num;
+  }
+  *used = pos;
+  return num;
+}
+
+static unsigned long parse(const unsigned char *data, int size, int block,
+struct rtcm3 *r)
+{
+  const unsigned char *frame;
+  unsigned long bytes = 0;
+  int pos, n;
+  for(pos = 0; pos < size; pos += block)
+  {
+    const char *b = (const char *)data+pos;
+    int s = size-pos < block ? size-pos : block;
+    while((n = Rtcm3Next(r, &b, &s, &frame)))
+      bytes += n;
+  }
+  return bytes;
+}
+
+/* sets len bits starting at bit pos of the message */
+static void setbits(unsigned char *msg, int pos, int len, unsigned long val)
+{
+  for(--len; len >= 0; ++pos, --len)
+  {
+    if((val >> len) & 1)
+      msg[pos >> 3] |= 1 << (7 - (pos & 7));
+    else
+      msg[pos >> 3] &= ~(1 << (7 - (pos & 7)));
+  }
+}
+
+/* the age of a GPS MSM and a GLONASS MSM 1 s before the arrival */
+static int checkage(void)
+{
+  double arrival = 1700000000123.0, q = 0.5;
+  long p;
+  long long gps = (long long)arrival - RTCM3GPSEPOCH + GPSUTCLEAP*1000LL;
+  unsigned char f[20];
+  struct rtcm3age a;
+
+  memset(&a, 0, sizeof(a));
+  memset(f, 0, sizeof(f));
+  f[0] = RTCM3PREAMBLE;
+  f[2] = sizeof(f)-6;
+  setbits(f+3, 0, 12, 1077);
+  setbits(f+3, 24, 30, gps % RTCM3WEEK - 1000);
+  if(Rtcm3Age(&a, f, sizeof(f), arrival) != 1000)
+    return 0;
+  Rtcm3AgePercentiles(&a.t[0], &q, &p, 1);
+  if(p != 1000)
+    return 0;
+  setbits(f+3, 0, 12, 1087);
+  setbits(f+3, 24, 3, 0);
+  setbits(f+3, 27, 27, ((long long)arrival + 3*3600000LL) % RTCM3DAY - 1000);
+  return Rtcm3Age(&a, f, sizeof(f), arrival) == 1000 && a.types == 2;
+}
+
+/* the multiple message bit of an MSM, a GPS RTK and a GLONASS RTK message */
+static int checkepochend(void)
+{
+  unsigned char f[20];
+
+  memset(f, 0, sizeof(f));
+  f[0] = RTCM3PREAMBLE;
+  f[2] = sizeof(f)-6;
+  setbits(f+3, 0, 12, 1077);
+  setbits(f+3, 54, 1, 1);
+  if(Rtcm3EpochEnd(f, sizeof(f)) != 0)
+    return 0;
+  setbits(f+3, 0, 12, 1004);
+  setbits(f+3, 54, 1, 0);
+  if(Rtcm3EpochEnd(f, sizeof(f)) != 1)
+    return 0;
+  setbits(f+3, 0, 12, 1012);
+  setbits(f+3, 51, 1, 1);
+  if(Rtcm3EpochEnd(f, sizeof(f)) != 0)
+    return 0;
+  setbits(f+3, 0, 12, 1005);
+  return Rtcm3EpochEnd(f, sizeof(f)) == -1;
+}
+
+/* an epoch of a GPS MSM, a station message and a Galileo MSM, which
+   ends it 20 ms after the first one arrived and 500 ms after the epoch */
+static int checkepoch(void)
+{
+  double arrival = 1700000000123.0;
+  long long gps = (long long)arrival - RTCM3GPSEPOCH + GPSUTCLEAP*1000LL;
+  unsigned char f[3][20];
+  struct rtcm3epoch *e = malloc(sizeof(*e));
+  int i, res;
+
+  if(!e)
+    return 0;
+  memset(e, 0, sizeof(*e));
+  memset(f, 0, sizeof(f));
+  for(i = 0; i < 3; ++i)
+  {
+    f[i][0] = RTCM3PREAMBLE;
+    f[i][2] = sizeof(f[i])-6;
+  }
+  setbits(f[0]+3, 0, 12, 1077);
+  setbits(f[0]+3, 24, 30, gps % RTCM3WEEK - 480);
+  setbits(f[0]+3, 54, 1, 1);
+  setbits(f[1]+3, 0, 12, 1005);
+  setbits(f[2]+3, 0, 12, 1097);
+  setbits(f[2]+3, 24, 30, gps % RTCM3WEEK - 480);
+  for(i = 0; i < 3; ++i)
+  {
+    if(Rtcm3EpochPut(e, f[i], sizeof(f[i]), Rtcm3EpochEnd(f[i], sizeof(f[i])),
+    arrival + 10*i) != (i == 2))
+      break;
+  }
+  res = i == 3 && e->size == sizeof(f) && !memcmp(e->buf, f, sizeof(f))
+  && e->maxassembly == 20 && e->completion == 500;
+  Rtcm3EpochClear(e);
+  Rtcm3EpochPut(e, f[0], sizeof(f[0]), 0, arrival);
+  res = res && !Rtcm3EpochFull(e, RTCM3EPOCHMAX-sizeof(f[0]))
+  && Rtcm3EpochFull(e, RTCM3EPOCHMAX);
+  Rtcm3EpochClear(e);
+  res = res && e->complete == 1 && e->incomplete == 1 && !e->size;
+  free(e);
+  return res;
+}
+
+int main(void)
+{
+  unsigned char *data = malloc(BENCHSIZE);
+  unsigned long crc = 0;
+  struct rtcm3 r;
+  struct rtcm3age age;
+  double t;
+  int num, size, i, pos, blocks[] = {1000, 16384};
+
+  if(!data)
+    return 1;
+  Rtcm3Init();
+  srand(1);
+  num = makeframes(data, BENCHSIZE, &size);
+  for(i = 0; i < 1000; ++i)
+  {
+    int s = rand() % 1029;
+    if(Rtcm3CRC(data+i, s) != crcbitwise(data+i, s))
+    {
+      fprintf(stderr, "CRC mismatch for %d bytes\n", s);
+      return 1;
+    }
+  }
+  printf("%d frames, %d bytes\n", num, size);
+
+  t = now();
+  crc ^= crcbytewise(data, size);
+  t = now()-t;
+  printf("CRC-24Q bytewise:      %6.2f GB/s\n", size/t*1e-9);
+  t = now();
+  crc ^= Rtcm3CRC(data, size);
+  t = now()-t;
+  printf("CRC-24Q slicing-by-8:  %6.2f GB/s\n", size/t*1e-9);
+
+  memset(&r, 0, sizeof(r));
+  for(i = 0; i < 2; ++i)
+  {
+    Rtcm3Reset(&r);
+    r.frames = 0;
+    t = now();
+    if(parse(data, size, blocks[i], &r) != (unsigned long)size
+    || r.frames != (unsigned long)num)
+    {
+      fprintf(stderr, "Frame parser lost data\n");
+      return 1;
+    }
+    t = now()-t;
+    printf("Frame parser, %5d byte input: %6.2f GB/s\n", blocks[i],
+    size/t*1e-9);
+  }
+
+  if(!checkage())
+  {
+    fprintf(stderr, "Correction age wrong\n");
+    return 1;
+  }
+  if(!checkepochend())
+  {
+    fprintf(stderr, "Epoch end wrong\n");
+    return 1;
+  }
+  if(!checkepoch())
+  {
+    fprintf(stderr, "Epoch assembly wrong\n");
+    return 1;
+  }
+  memset(&age, 0, sizeof(age));
+  t = now();
+  for(pos = 0; pos < size; pos += Rtcm3FrameSize(data+pos))
+    Rtcm3Age(&age, data+pos, Rtcm3FrameSize(data+pos), 1700000000000.0);
+  t = now()-t;
+  printf("Correction age:        %6.2f Mframes/s\n", num/t*1e-6);
+
+  /* damage one byte every 10000 bytes, the parser must resync */
+  for(i = 5000; i < size; i += 10000)
+    data[i] ^= 0x55;
+  memset(&r, 0, sizeof(r));
+  Rtcm3Reset(&r);
+  t = now();
+  parse(data, size, 1000, &r);
+  t = now()-t;
+  printf("Frame parser, damaged data:   %6.2f GB/s, %lu of %d frames, "
+  "%lu checksum errors\n", size/t*1e-9, r.frames, num, r.crcerrors);
+  free(data);
+  return crc == 0xFFFFFFFF; /* keeps the CRC loops */
+}
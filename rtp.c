@@ -0,0 +1,180 @@
+/*
+  RTP packet reordering for NTRIP client for POSIX.
+  $Id$
+  Copyright (C) 2026 by the ntripclient contributors
+  <https://github.com/nunojpg/ntripclient>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+  or read http://www.gnu.org/licenses/gpl.txt
+*/
+
+/* system includes */
+#include <string.h>
+
+/* Packets which arrive out of order are held until the missing ones came
+   or the oldest held packet waited longer than the allowed latency. The
+   16 bit RTP sequence numbers are extended to 32 bit, so wrap arounds do
+   not disturb the order. */
+#define RTPSLOTS   32   /* packets held at most */
+#define RTPMAXDATA 1514
+
+struct rtpslot
+{
+  int           used;
+  int           size;
+  unsigned long seq;     /* extended sequence number */
+  double        arrival; /* ms */
+  char          data[RTPMAXDATA];
+};
+
+struct rtpbuffer
+{
+  struct rtpslot slot[RTPSLOTS];
+  struct rtpslot pending;  /* packet which does not fit into the window */
+  int            started;
+  int            held;     /* packets in the buffer including pending */
+  unsigned long  next;     /* sequence number output next */
+  unsigned long  highest;  /* highest sequence number received */
+  double         latency;  /* ms a packet waits for missing ones */
+  unsigned long  received;
+  unsigned long  reordered;  /* packets arriving after a later one */
+  unsigned long  lost;       /* packets given up */
+  unsigned long  late;       /* packets arriving after their turn */
+  unsigned long  duplicates;
+};
+
+static void RtpInit(struct rtpbuffer *b, int latency)
+{
+  memset(b, 0, sizeof(*b));
+  b->latency = latency;
+}
+
+/* extends a 16 bit sequence number to the one nearest to the highest
+   sequence number received so far */
+static unsigned long RtpExtend(struct rtpbuffer *b, int seq)
+{
+  long d;
+
+  if(!b->started)
+  {
+    b->started = 1;
+    /* offset by one cycle so that earlier packets stay positive */
+    b->highest = b->next = 0x10000UL + (seq & 0xFFFF);
+    return b->highest;
+  }
+  d = (seq - (long)(b->highest & 0xFFFF)) & 0xFFFF;
+  if(d >= 0x8000)
+    d -= 0x10000;
+  if(d > 0)
+    b->highest += d;
+  return b->highest + (d < 0 ? d : 0);
+}
+
+/* stores a received packet, returns 0 when the packet is dropped because
+   it is too late or a duplicate, a packet beyond the window is held until
+   the packets before it are output, so the caller must call RtpNext()
+   while a packet is pending */
+static int RtpPut(struct rtpbuffer *b, int seq, const char *data, int size,
+double now)
+{
+  unsigned long highest = b->highest, ext = RtpExtend(b, seq);
+  struct rtpslot *s;
+
+  ++b->received;
+  if(ext < b->next)
+  {
+    ++b->late;
+    return 0;
+  }
+  /* the pending packet may fit into the window by now */
+  if(b->pending.used && b->pending.seq == ext)
+  {
+    ++b->duplicates;
+    return 0;
+  }
+  s = ext < b->next+RTPSLOTS ? &b->slot[ext % RTPSLOTS] : &b->pending;
+  if(s->used)
+  {
+    if(s->seq == ext)
+      ++b->duplicates;
+    else
+      ++b->lost; /* a second packet beyond the window */
+    return 0;
+  }
+  if(ext < highest)
+    ++b->reordered;
+  if(size > RTPMAXDATA)
+    size = RTPMAXDATA;
+  memcpy(s->data, data, size);
+  s->size = size;
+  s->seq = ext;
+  s->arrival = now;
+  s->used = 1;
+  ++b->held;
+  return 1;
+}
+
+/* returns the time in ms until the oldest held packet must be output, or
+   -1 when no packet is held */
+static double RtpWait(const struct rtpbuffer *b, double now)
+{
+  double oldest = now;
+  int i;
+
+  if(!b->held)
+    return -1;
+  for(i = 0; i < RTPSLOTS; ++i)
+  {
+    if(b->slot[i].used && b->slot[i].arrival < oldest)
+      oldest = b->slot[i].arrival;
+  }
+  if(b->pending.used && b->pending.arrival < oldest)
+    oldest = b->pending.arrival;
+  return oldest + b->latency > now ? oldest + b->latency - now : 0;
+}
+
+/* Returns the size of the next packet in sequence order and sets *data,
+   which stays valid until the next RtpPut() and while no packet is
+   pending also over further RtpNext() calls. Missing packets are skipped
+   when their deadline passed, when the window is full or with flush set.
+   Returns 0 when no packet is ready. */
+static int RtpNext(struct rtpbuffer *b, double now, int flush,
+const char **data)
+{
+  while(b->held)
+  {
+    struct rtpslot *s = &b->slot[b->next % RTPSLOTS];
+
+    if(b->pending.used && b->pending.seq < b->next+RTPSLOTS)
+    {
+      struct rtpslot *p = &b->slot[b->pending.seq % RTPSLOTS];
+      memcpy(p, &b->pending, sizeof(*p));
+      b->pending.used = 0;
+    }
+    if(s->used)
+    {
+      s->used = 0;
+      --b->held;
+      ++b->next;
+      *data = s->data;
+      return s->size;
+    }
+    if(!flush && !b->pending.used && RtpWait(b, now) > 0)
+      break;
+    ++b->lost;
+    ++b->next;
+  }
+  return 0;
+}
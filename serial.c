@@ -26,15 +26,21 @@
 #ifndef WINDOWSVERSION
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 #define SERIALDEFAULTDEVICE "/dev/ttyS0"
-enum SerialBaud {
-  SPABAUD_50 = B50, SPABAUD_110 = B110, SPABAUD_300 = B300, SPABAUD_600 = B600,
-  SPABAUD_1200 = B1200, SPABAUD_2400 = B2400, SPABAUD_4800 = B4800,
-  SPABAUD_9600 = B9600, SPABAUD_19200 = B19200,
-  SPABAUD_38400 = B38400, SPABAUD_57600 = B57600, SPABAUD_115200 = B115200 };
+#define HAVE_SERIALQUEUE
+#define HAVE_SERIALTIMING
 enum SerialDatabits {
   SPADATABITS_5 = CS5, SPADATABITS_6 = CS6, SPADATABITS_7 = CS7, SPADATABITS_8 = CS8 };
 enum SerialStopbits {
@@ -49,15 +55,11 @@ struct serial
 {
   struct termios Termios;
   int            Stream;
+  double         CharTime; /* ms one character takes on the line */
 };
 #else /* WINDOWSVERSION */
 #include <windows.h>
 #define SERIALDEFAULTDEVICE "COM1"
-enum SerialBaud {
-  SPABAUD_50 = 50, SPABAUD_110 = 110, SPABAUD_300 = 300, SPABAUD_600 = 600,
-  SPABAUD_1200 = 1200, SPABAUD_2400 = 2400, SPABAUD_4800 = 4800,
-  SPABAUD_9600 = 9600, SPABAUD_19200 = 19200,
-  SPABAUD_38400 = 38400, SPABAUD_57600 = 57600, SPABAUD_115200 = 115200 };
 enum SerialDatabits {
   SPADATABITS_5 = 5, SPADATABITS_6 = 6, SPADATABITS_7 = 7, SPADATABITS_8 = 8 };
 enum SerialStopbits {
@@ -71,6 +73,7 @@ struct serial
 {
   DCB    Termios;
   HANDLE Stream;
+  double CharTime; /* ms one character takes on the line */
 };
 #if !defined(__GNUC__)
 int strncasecmp(const char *a, const char *b, int len)
@@ -135,6 +138,73 @@ static enum SerialProtocol SerialGetProtocol(const char *buf, int *ressize)
 }
 
 #ifndef WINDOWSVERSION
+/* the baudrates termios knows, others are set with termios2 on Linux */
+static const struct
+{
+  int     rate;
+  speed_t flag;
+} serialbauds[] = {
+{50, B50}, {110, B110}, {300, B300}, {600, B600}, {1200, B1200},
+{2400, B2400}, {4800, B4800}, {9600, B9600}, {19200, B19200},
+{38400, B38400}, {57600, B57600}, {115200, B115200},
+#ifdef B230400
+{230400, B230400},
+#endif
+#ifdef B460800
+{460800, B460800},
+#endif
+#ifdef B500000
+{500000, B500000},
+#endif
+#ifdef B576000
+{576000, B576000},
+#endif
+#ifdef B921600
+{921600, B921600},
+#endif
+#ifdef B1000000
+{1000000, B1000000},
+#endif
+#ifdef B1500000
+{1500000, B1500000},
+#endif
+#ifdef B2000000
+{2000000, B2000000},
+#endif
+{0, 0}};
+
+#if defined(__linux__) && defined(TCGETS2)
+/* the layout of asm-generic/termbits.h, which clashes with termios.h */
+struct termios2
+{
+  tcflag_t c_iflag;
+  tcflag_t c_oflag;
+  tcflag_t c_cflag;
+  tcflag_t c_lflag;
+  cc_t     c_line;
+  cc_t     c_cc[19];
+  speed_t  c_ispeed;
+  speed_t  c_ospeed;
+};
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+
+/* sets a baudrate termios does not know */
+static int SerialOtherBaud(int fd, int rate)
+{
+  struct termios2 t;
+
+  if(ioctl(fd, TCGETS2, &t) < 0)
+    return 0;
+  t.c_cflag &= ~CBAUD;
+  t.c_cflag |= BOTHER;
+  t.c_ispeed = t.c_ospeed = rate;
+  return ioctl(fd, TCSETS2, &t) >= 0;
+}
+#define HAVE_SERIALOTHERBAUD
+#endif /* __linux__ && TCGETS2 */
+
 static void SerialFree(struct serial *sn)
 {
   if(sn->Stream)
@@ -147,7 +217,7 @@ static void SerialFree(struct serial *sn)
 }
 
 static const char * SerialInit(struct serial *sn,
-const char *Device, enum SerialBaud Baud, enum SerialStopbits StopBits,
+const char *Device, int Baud, enum SerialStopbits StopBits,
 enum SerialProtocol Protocol, enum SerialParity Parity,
 enum SerialDatabits DataBits, int dowrite
 #ifdef __GNUC__
@@ -156,14 +226,26 @@ __attribute__((__unused__))
 )
 {
   struct termios newtermios;
+  int i;
 
+  for(i = 0; serialbauds[i].rate && serialbauds[i].rate != Baud; ++i)
+    ;
+#ifndef HAVE_SERIALOTHERBAUD
+  if(!serialbauds[i].rate)
+    return "baudrate not supported";
+#endif
   if((sn->Stream = open(Device, O_RDWR | O_NOCTTY | O_NONBLOCK)) <= 0)
     return "could not open serial port";
   tcgetattr(sn->Stream, &sn->Termios);
 
+  sn->CharTime = 1000.0*(1 + (DataBits == SPADATABITS_5 ? 5
+  : DataBits == SPADATABITS_6 ? 6 : DataBits == SPADATABITS_7 ? 7 : 8)
+  + (Parity != SPAPARITY_NONE) + (StopBits == SPASTOPBITS_2 ? 2 : 1))
+  / Baud;
+
   memset(&newtermios, 0, sizeof(struct termios));
-  newtermios.c_cflag = Baud | StopBits | Parity | DataBits
-  | CLOCAL | CREAD;
+  newtermios.c_cflag = (serialbauds[i].rate ? serialbauds[i].flag : B38400)
+  | StopBits | Parity | DataBits | CLOCAL | CREAD;
   if(Protocol == SPAPROTOCOL_RTS_CTS)
     newtermios.c_cflag |= CRTSCTS;
   else
@@ -171,11 +253,47 @@ __attribute__((__unused__))
   newtermios.c_cc[VMIN] = 1;
   tcflush(sn->Stream, TCIOFLUSH);
   tcsetattr(sn->Stream, TCSANOW, &newtermios);
+#ifdef HAVE_SERIALOTHERBAUD
+  if(!serialbauds[i].rate && !SerialOtherBaud(sn->Stream, Baud))
+  {
+    SerialFree(sn);
+    return "could not set baudrate";
+  }
+#endif
   tcflush(sn->Stream, TCIOFLUSH);
   fcntl(sn->Stream, F_SETFL, O_NONBLOCK);
   return 0;
 }
 
+/* Sets VMIN and VTIME (1/10 s): poll() reports the device readable when
+   vmin bytes arrived or, with vtime, when any byte arrived. The low
+   latency flag makes the driver pass on each byte at once, USB adapters
+   then also shorten their latency timer. Drivers without it ignore it. */
+static const char *SerialTiming(struct serial *sn, int vmin, int vtime,
+int lowlatency)
+{
+  struct termios t;
+
+  if(lowlatency)
+  {
+#ifdef ASYNC_LOW_LATENCY
+    struct serial_struct s;
+    if(!ioctl(sn->Stream, TIOCGSERIAL, &s))
+    {
+      s.flags |= ASYNC_LOW_LATENCY;
+      ioctl(sn->Stream, TIOCSSERIAL, &s);
+    }
+#endif
+  }
+  if(tcgetattr(sn->Stream, &t) < 0)
+    return "could not read serial settings";
+  t.c_cc[VMIN] = vmin;
+  t.c_cc[VTIME] = vtime;
+  if(tcsetattr(sn->Stream, TCSANOW, &t) < 0)
+    return "could not set VMIN and VTIME";
+  return 0;
+}
+
 static int SerialRead(struct serial *sn, char *buffer, size_t size)
 {
   int j = read(sn->Stream, buffer, size);
@@ -202,6 +320,305 @@ static int SerialWrite(struct serial *sn, const char *buffer, size_t size)
   return j;
 }
 
+/* Writing to the serial device by a separate thread, so a slow device
+   never stops the network reception. The receiving thread puts blocks
+   into a single-producer/single-consumer ring, each block prefixed by its
+   2 byte length and the 4 low bytes of its arrival time in ms. When the
+   ring is full, either the oldest blocks are dropped (the receiving
+   thread then advances the tail as well) or the receiving thread waits.
+   The mutex is only used to sleep and wake up.
+   With a maximum age the kernel buffer of the device (TIOCOUTQ) gets
+   only SERIALPACE ms of data ahead, the rest stays in the ring. A block
+   which would not be sent completely within the maximum age after its
+   arrival is dropped, together with the following blocks of the same
+   arrival time, so an epoch received at once is dropped as a whole.
+   To measure the delivery the time a written block needs to leave the
+   device is estimated from the data before it in the kernel buffer, the
+   writer thread does not wait for it. */
+#define SERIALBLOCKMAX  4096
+#define SERIALBLOCKHEAD 6
+#define SERIALPACE      20
+
+enum SerialOverflow { SPAOVERFLOW_DROP, SPAOVERFLOW_BLOCK };
+
+struct serialqueue
+{
+  struct serial      *serial;
+  enum SerialOverflow overflow;
+  unsigned char      *buf;
+  size_t              size;         /* power of 2 */
+  atomic_size_t       head;         /* advanced by the receiving thread */
+  atomic_size_t       tail;         /* advanced by both threads */
+  atomic_int          waiting;      /* writer thread sleeps */
+  atomic_int          full;         /* receiving thread sleeps */
+  atomic_int          quit;
+  atomic_int          error;
+  unsigned long       dropped;      /* blocks, only receiving thread */
+  unsigned long       droppedbytes;
+  double              maxage;       /* ms, 0 for none */
+  atomic_ulong        stale;        /* blocks too old, only writer thread */
+  atomic_ulong        stalebytes;
+  int                 delivery;     /* measure the delivery */
+  atomic_ulong        delivered;    /* blocks, only writer thread */
+  atomic_ulong        deliveryms;   /* summed from arrival until sent */
+  atomic_ulong        maxdeliveryms;
+  pthread_t           thread;
+  pthread_mutex_t     mutex;
+  pthread_cond_t      cond;
+};
+
+static void SerialQueueCopy(struct serialqueue *q, size_t pos,
+unsigned char *dst, size_t size)
+{
+  size_t ofs = pos & (q->size-1), n = q->size-ofs;
+  if(n > size) n = size;
+  memcpy(dst, q->buf+ofs, n);
+  memcpy(dst+n, q->buf, size-n);
+}
+
+static void SerialQueuePutData(struct serialqueue *q, size_t pos,
+const unsigned char *src, size_t size)
+{
+  size_t ofs = pos & (q->size-1), n = q->size-ofs;
+  if(n > size) n = size;
+  memcpy(q->buf+ofs, src, n);
+  memcpy(q->buf, src+n, size-n);
+}
+
+/* returns the monotonic time in ms, as far as it fits in 4 bytes */
+static unsigned long SerialQueueTime(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec*1000UL + ts.tv_nsec/1000000) & 0xFFFFFFFFUL;
+}
+
+/* returns the time in ms until the data in the kernel buffer is sent */
+static double SerialQueueDelay(struct serialqueue *q)
+{
+#ifdef TIOCOUTQ
+  int n;
+  if(!ioctl(q->serial->Stream, TIOCOUTQ, &n) && n > 0)
+    return n*q->serial->CharTime;
+#endif
+  return 0;
+}
+
+static size_t SerialQueueBlockSize(struct serialqueue *q, size_t pos)
+{
+  unsigned char l[2];
+  size_t size;
+  SerialQueueCopy(q, pos, l, 2);
+  size = (l[0] << 8) | l[1];
+  return size > SERIALBLOCKMAX ? SERIALBLOCKMAX : size;
+}
+
+static unsigned long SerialQueueBlockTime(struct serialqueue *q, size_t pos)
+{
+  unsigned char t[4];
+  SerialQueueCopy(q, pos+2, t, 4);
+  return ((unsigned long)t[0] << 24) | (t[1] << 16) | (t[2] << 8) | t[3];
+}
+
+static void SerialQueueWake(struct serialqueue *q, atomic_int *flag)
+{
+  if(atomic_load(flag))
+  {
+    pthread_mutex_lock(&q->mutex);
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+  }
+}
+
+static void *SerialQueueThread(void *data)
+{
+  struct serialqueue *q = data;
+  unsigned char block[SERIALBLOCKMAX];
+  unsigned long stalearrival = 0;
+  int stale = 0;
+
+  for(;;)
+  {
+    size_t tail = atomic_load(&q->tail), size;
+    unsigned long arrival;
+    double delay = 0;
+    int ofs = 0;
+
+    if(tail == atomic_load(&q->head))
+    {
+      if(atomic_load(&q->quit))
+        break;
+      pthread_mutex_lock(&q->mutex);
+      atomic_store(&q->waiting, 1);
+      if(tail == atomic_load(&q->head) && !atomic_load(&q->quit))
+        pthread_cond_wait(&q->cond, &q->mutex);
+      atomic_store(&q->waiting, 0);
+      pthread_mutex_unlock(&q->mutex);
+      continue;
+    }
+    if(q->maxage && (delay = SerialQueueDelay(q)) > SERIALPACE)
+    {
+      poll(0, 0, delay < SERIALPACE+100 ? (int)(delay-SERIALPACE)+1 : 100);
+      continue;
+    }
+    /* copy first, the block is ours only when nobody dropped it meanwhile */
+    size = SerialQueueBlockSize(q, tail);
+    arrival = SerialQueueBlockTime(q, tail);
+    SerialQueueCopy(q, tail+SERIALBLOCKHEAD, block, size);
+    if(!atomic_compare_exchange_strong(&q->tail, &tail,
+    tail+SERIALBLOCKHEAD+size))
+      continue;
+    SerialQueueWake(q, &q->full);
+    if(q->maxage && ((stale && arrival == stalearrival)
+    || ((SerialQueueTime() - arrival) & 0xFFFFFFFFUL) + delay
+    + size*q->serial->CharTime > q->maxage))
+    {
+      atomic_fetch_add(&q->stale, 1);
+      atomic_fetch_add(&q->stalebytes, size);
+      stalearrival = arrival;
+      stale = 1;
+      continue;
+    }
+    while(ofs < (int)size)
+    {
+      int j = write(q->serial->Stream, block+ofs, size-ofs);
+      if(j < 0 && errno != EAGAIN && errno != EINTR)
+      {
+        atomic_store(&q->error, 1);
+        return 0;
+      }
+      else if(j > 0)
+        ofs += j;
+      else
+      {
+        struct pollfd p = {q->serial->Stream, POLLOUT, 0};
+        if(!poll(&p, 1, 1000) && atomic_load(&q->quit))
+          return 0;
+      }
+    }
+    if(q->delivery)
+    {
+      unsigned long ms = ((SerialQueueTime() - arrival) & 0xFFFFFFFFUL)
+      + (unsigned long)SerialQueueDelay(q);
+      atomic_fetch_add(&q->delivered, 1);
+      atomic_fetch_add(&q->deliveryms, ms);
+      if(ms > atomic_load(&q->maxdeliveryms))
+        atomic_store(&q->maxdeliveryms, ms);
+    }
+  }
+  return 0;
+}
+
+/* starts the writer thread with a ring of at least size bytes, data older
+   than maxage ms is dropped unless it is 0, with delivery the time until
+   the data left the device is measured */
+static const char *SerialQueueStart(struct serialqueue *q, struct serial *sn,
+size_t size, enum SerialOverflow overflow, double maxage, int delivery)
+{
+  memset(q, 0, sizeof(*q));
+  if(size < 2*(SERIALBLOCKMAX+SERIALBLOCKHEAD))
+    size = 2*(SERIALBLOCKMAX+SERIALBLOCKHEAD);
+  for(q->size = 1; q->size < size; q->size <<= 1)
+    ;
+  if(!(q->buf = malloc(q->size)))
+    return "could not allocate serial queue";
+  q->serial = sn;
+  q->overflow = overflow;
+  q->maxage = maxage;
+  q->delivery = delivery;
+  pthread_mutex_init(&q->mutex, 0);
+  pthread_cond_init(&q->cond, 0);
+  if(pthread_create(&q->thread, 0, SerialQueueThread, q))
+  {
+    free(q->buf);
+    q->buf = 0;
+    return "could not start serial writer thread";
+  }
+  return 0;
+}
+
+/* writes the queued data and stops the writer thread */
+static void SerialQueueStop(struct serialqueue *q)
+{
+  if(q->buf)
+  {
+    atomic_store(&q->quit, 1);
+    pthread_mutex_lock(&q->mutex);
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+    pthread_join(q->thread, 0);
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->cond);
+    free(q->buf);
+    q->buf = 0;
+  }
+}
+
+/* returns the number of bytes waiting in the queue */
+static size_t SerialQueueUsed(struct serialqueue *q)
+{
+  return atomic_load_explicit(&q->head, memory_order_relaxed)
+  - atomic_load_explicit(&q->tail, memory_order_relaxed);
+}
+
+/* queues the data for the writer thread, returns -1 when the serial
+   device failed */
+static int SerialQueueWrite(struct serialqueue *q, const char *buffer,
+size_t size)
+{
+  while(size)
+  {
+    size_t n = size > SERIALBLOCKMAX ? SERIALBLOCKMAX : size;
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load(&q->tail);
+    unsigned long arrival = SerialQueueTime();
+    unsigned char l[SERIALBLOCKHEAD];
+
+    if(atomic_load(&q->error))
+      return -1;
+    if(q->size - (head-tail) < n+SERIALBLOCKHEAD)
+    {
+      if(q->overflow == SPAOVERFLOW_DROP)
+      {
+        size_t s = SerialQueueBlockSize(q, tail);
+        if(atomic_compare_exchange_strong(&q->tail, &tail,
+        tail+SERIALBLOCKHEAD+s))
+        {
+          ++q->dropped;
+          q->droppedbytes += s;
+        }
+      }
+      else
+      {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ++ts.tv_sec;
+        pthread_mutex_lock(&q->mutex);
+        atomic_store(&q->full, 1);
+        if(q->size - (head-atomic_load(&q->tail)) < n+SERIALBLOCKHEAD)
+          pthread_cond_timedwait(&q->cond, &q->mutex, &ts);
+        atomic_store(&q->full, 0);
+        pthread_mutex_unlock(&q->mutex);
+      }
+      continue;
+    }
+    l[0] = n >> 8;
+    l[1] = n;
+    l[2] = arrival >> 24;
+    l[3] = arrival >> 16;
+    l[4] = arrival >> 8;
+    l[5] = arrival;
+    SerialQueuePutData(q, head, l, SERIALBLOCKHEAD);
+    SerialQueuePutData(q, head+SERIALBLOCKHEAD, (const unsigned char *)buffer,
+    n);
+    atomic_store(&q->head, head+SERIALBLOCKHEAD+n);
+    SerialQueueWake(q, &q->waiting);
+    buffer += n;
+    size -= n;
+  }
+  return 0;
+}
+
 #else /* WINDOWSVERSION */
 static void SerialFree(struct serial *sn)
 {
@@ -215,7 +632,7 @@ static void SerialFree(struct serial *sn)
 }
 
 static const char * SerialInit(struct serial *sn, const char *Device,
-enum SerialBaud Baud, enum SerialStopbits StopBits,
+int Baud, enum SerialStopbits StopBits,
 enum SerialProtocol Protocol, enum SerialParity Parity,
 enum SerialDatabits DataBits, int dowrite)
 {
@@ -232,6 +649,8 @@ enum SerialDatabits DataBits, int dowrite)
 
   memset(&sn->Termios, 0, sizeof(sn->Termios));
   GetCommState(sn->Stream, &sn->Termios);
+  sn->CharTime = 1000.0*(1 + DataBits + (Parity != SPAPARITY_NONE)
+  + StopBits) / Baud;
 
   DCB dcb;
   memset(&dcb, 0, sizeof(dcb));
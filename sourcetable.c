@@ -0,0 +1,826 @@
+/*
+  Sourcetable cache and query engine for NTRIP client for POSIX.
+  $Id$
+  Copyright (C) 2026 by the ntripclient contributors
+  <https://github.com/nunojpg/ntripclient>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+  or read http://www.gnu.org/licenses/gpl.txt
+*/
+
+/* system includes */
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The sourcetable is stored by column. The fields of all lines are
+   strings in one pool, where equal strings are stored only once, and the
+   field c of line r is the string at offset cell[c*lines+r] of the pool.
+   Offset 0 is the empty string, used also for missing fields. The cache
+   file holds these arrays in native byte order together with the caster
+   and the download time. */
+#define SOURCETABLEMAGIC   "NTRIPSTC 1\n"
+#define SOURCETABLEMAXLINE 4096
+#define SOURCETABLEMAXCOLS 32
+#define SOURCETABLEMAXNODE 64   /* operators and values of a query field */
+
+struct sourcetable
+{
+  char           caster[256];  /* host:port */
+  long           fetched;      /* download time in seconds since 1970 */
+  int            lines;
+  int            cols;         /* fields of the longest line */
+  unsigned char *fields;       /* fields of each line */
+  unsigned int  *cell;         /* cols*lines pool offsets */
+  char          *pool;
+  unsigned int   poolsize;
+  /* only used while the sourcetable is received */
+  char           line[SOURCETABLEMAXLINE];
+  int            linelen;
+  int            maxlines;
+  unsigned int   poolmax;
+  unsigned int  *hash;         /* pool offsets of the strings, 0 for free */
+  unsigned int   hashsize;
+  unsigned int   hashused;
+  int            complete;     /* ENDSOURCETABLE received */
+};
+
+static void SourcetableInit(struct sourcetable *t, const char *caster,
+long fetched)
+{
+  memset(t, 0, sizeof(*t));
+  snprintf(t->caster, sizeof(t->caster), "%s", caster);
+  t->fetched = fetched;
+}
+
+static void SourcetableFree(struct sourcetable *t)
+{
+  free(t->fields);
+  free(t->cell);
+  free(t->pool);
+  free(t->hash);
+  t->fields = 0;
+  t->cell = 0;
+  t->pool = 0;
+  t->hash = 0;
+}
+
+static unsigned int SourcetableHash(const char *s, int len)
+{
+  unsigned int h = 2166136261U;
+  while(len--)
+    h = (h ^ (unsigned char)*s++) * 16777619U;
+  return h;
+}
+
+/* returns the pool offset of the string, which is added when it is new,
+   or 0 when memory is missing */
+static unsigned int SourcetableString(struct sourcetable *t, const char *s,
+int len)
+{
+  unsigned int h, o;
+
+  if(!len)
+    return 0;
+  if(2*(t->hashused+1) > t->hashsize)
+  {
+    unsigned int size = t->hashsize ? 2*t->hashsize : 1024, i;
+    unsigned int *n = calloc(size, sizeof(*n));
+    if(!n)
+      return 0;
+    for(i = 0; i < t->hashsize; ++i)
+    {
+      if((o = t->hash[i]))
+      {
+        for(h = SourcetableHash(t->pool+o, strlen(t->pool+o)) & (size-1);
+        n[h]; h = (h+1) & (size-1))
+          ;
+        n[h] = o;
+      }
+    }
+    free(t->hash);
+    t->hash = n;
+    t->hashsize = size;
+  }
+  for(h = SourcetableHash(s, len) & (t->hashsize-1); (o = t->hash[h]);
+  h = (h+1) & (t->hashsize-1))
+  {
+    if(!strncmp(t->pool+o, s, len) && !t->pool[o+len])
+      return o;
+  }
+  if(t->poolsize+len+1 > t->poolmax)
+  {
+    unsigned int max = t->poolmax*2+len+65536;
+    char *p = realloc(t->pool, max);
+    if(!p)
+      return 0;
+    t->pool = p;
+    t->poolmax = max;
+  }
+  if(!t->poolsize)
+    t->pool[t->poolsize++] = 0;
+  o = t->poolsize;
+  memcpy(t->pool+o, s, len);
+  t->pool[o+len] = 0;
+  t->poolsize += len+1;
+  t->hash[h] = o;
+  ++t->hashused;
+  return o;
+}
+
+/* stores a STR, CAS or NET line, the cells are kept line by line in
+   t->cell until SourcetableFinish(), returns 0 when memory is missing */
+static int SourcetableLine(struct sourcetable *t, const char *l, int len)
+{
+  unsigned int *row;
+  int c = 0;
+
+  if(len && l[len-1] == '\r')
+    --len;
+  if(len >= 14 && !strncmp(l, "ENDSOURCETABLE", 14))
+    t->complete = 1;
+  if(len < 4 || l[3] != ';' || (strncmp(l, "STR", 3) && strncmp(l, "CAS", 3)
+  && strncmp(l, "NET", 3)))
+    return 1;
+  if(t->lines == t->maxlines)
+  {
+    int max = t->maxlines*2+256;
+    unsigned int *n = realloc(t->cell, max*SOURCETABLEMAXCOLS*sizeof(*n));
+    unsigned char *f = realloc(t->fields, max);
+    if(n)
+      t->cell = n;
+    if(f)
+      t->fields = f;
+    if(!n || !f)
+      return 0;
+    t->maxlines = max;
+  }
+  row = t->cell + t->lines*SOURCETABLEMAXCOLS;
+  while(c < SOURCETABLEMAXCOLS)
+  {
+    const char *e = memchr(l, ';', len);
+    int n = e ? e-l : len;
+    if(n && !(row[c] = SourcetableString(t, l, n)))
+      return 0;
+    if(!n)
+      row[c] = 0;
+    ++c;
+    if(!e)
+      break;
+    len -= n+1;
+    l = e+1;
+  }
+  t->fields[t->lines++] = c;
+  if(c > t->cols)
+    t->cols = c;
+  return 1;
+}
+
+/* adds received sourcetable data, lines which are no STR, CAS or NET
+   records are skipped, returns 0 when memory is missing */
+static int SourcetableAdd(struct sourcetable *t, const char *buf, int size)
+{
+  while(size > 0)
+  {
+    const char *e = memchr(buf, '\n', size);
+    int n = e ? e-buf : size;
+    if(t->linelen+n < SOURCETABLEMAXLINE)
+    {
+      memcpy(t->line+t->linelen, buf, n);
+      t->linelen += n;
+    }
+    if(e)
+    {
+      if(!SourcetableLine(t, t->line, t->linelen))
+        return 0;
+      t->linelen = 0;
+      ++n;
+    }
+    buf += n;
+    size -= n;
+  }
+  return 1;
+}
+
+/* ends the input and arranges the cells by column, returns 0 when memory
+   is missing */
+static int SourcetableFinish(struct sourcetable *t)
+{
+  unsigned int *cell;
+  int r, c;
+
+  if(t->linelen && !SourcetableLine(t, t->line, t->linelen))
+    return 0;
+  t->linelen = 0;
+  if(!t->pool && !(t->pool = calloc(1, 1)))
+    return 0;
+  if(!t->poolsize)
+    t->poolsize = 1;
+  if(!(cell = malloc((t->cols*t->lines+1)*sizeof(*cell))))
+    return 0;
+  for(r = 0; r < t->lines; ++r)
+  {
+    for(c = 0; c < t->cols; ++c)
+      cell[c*t->lines+r] = c < t->fields[r]
+      ? t->cell[r*SOURCETABLEMAXCOLS+c] : 0;
+  }
+  free(t->cell);
+  free(t->hash);
+  t->cell = cell;
+  t->hash = 0;
+  t->hashsize = t->hashused = 0;
+  return 1;
+}
+
+static const char *SourcetableCell(const struct sourcetable *t, int c, int r)
+{
+  return c < t->cols ? t->pool + t->cell[c*t->lines+r] : "";
+}
+
+/* writes the cache file, a temporary file is renamed so readers never see
+   a partial cache */
+static const char *SourcetableSave(const struct sourcetable *t,
+const char *name)
+{
+  char tmp[1024];
+  FILE *f;
+  int ok;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+  if(!(f = fopen(tmp, "wb")))
+    return "Could not create sourcetable cache file.";
+  ok = fprintf(f, SOURCETABLEMAGIC "%s\n%ld %d %d %u\n", t->caster,
+  t->fetched, t->lines, t->cols, t->poolsize) > 0
+  && fwrite(t->fields, 1, t->lines, f) == (size_t)t->lines
+  && fwrite(t->cell, sizeof(*t->cell), t->cols*t->lines, f)
+  == (size_t)(t->cols*t->lines)
+  && fwrite(t->pool, 1, t->poolsize, f) == t->poolsize;
+  if(fclose(f) || !ok)
+  {
+    remove(tmp);
+    return "Could not write sourcetable cache file.";
+  }
+  if(rename(tmp, name) && (remove(name) || rename(tmp, name)))
+  {
+    remove(tmp);
+    return "Could not replace sourcetable cache file.";
+  }
+  return 0;
+}
+
+/* reads the cache file, returns an error text when it is missing or
+   damaged */
+static const char *SourcetableLoad(struct sourcetable *t, const char *name)
+{
+  char magic[sizeof(SOURCETABLEMAGIC)];
+  const char *err = "Sourcetable cache file damaged.";
+  FILE *f;
+  int i;
+
+  memset(t, 0, sizeof(*t));
+  if(!(f = fopen(name, "rb")))
+    return "Could not open sourcetable cache file.";
+  if(!fgets(magic, sizeof(magic), f) || strcmp(magic, SOURCETABLEMAGIC)
+  || !fgets(t->caster, sizeof(t->caster), f) || !strchr(t->caster, '\n')
+  || fscanf(f, "%ld %d %d %u", &t->fetched, &t->lines, &t->cols,
+  &t->poolsize) != 4 || fgetc(f) != '\n' || t->lines < 0 || t->cols < 0
+  || t->cols > SOURCETABLEMAXCOLS || !t->poolsize)
+  {
+    fclose(f);
+    return err;
+  }
+  *strchr(t->caster, '\n') = 0;
+  if(!(t->fields = malloc(t->lines+1))
+  || !(t->cell = malloc((t->cols*t->lines+1)*sizeof(*t->cell)))
+  || !(t->pool = malloc(t->poolsize)))
+    err = "Could not allocate memory for the sourcetable.";
+  else if(fread(t->fields, 1, t->lines, f) == (size_t)t->lines
+  && fread(t->cell, sizeof(*t->cell), t->cols*t->lines, f)
+  == (size_t)(t->cols*t->lines)
+  && fread(t->pool, 1, t->poolsize, f) == t->poolsize
+  && !t->pool[t->poolsize-1])
+  {
+    err = 0;
+    for(i = 0; i < t->cols*t->lines && !err; ++i)
+    {
+      if(t->cell[i] >= t->poolsize)
+        err = "Sourcetable cache file damaged.";
+    }
+    for(i = 0; i < t->lines && !err; ++i)
+    {
+      if(t->fields[i] > t->cols)
+        err = "Sourcetable cache file damaged.";
+    }
+  }
+  fclose(f);
+  if(err)
+    SourcetableFree(t);
+  return err;
+}
+
+/* The query of one field is compiled into a tree of nodes. Values are
+   compared as numbers for the operators <, >, <=, >=, =, != and ~, else
+   as text ignoring case with '*' matching any characters. */
+enum SourcetableOp { STOR, STAND, STNOT, STLT, STGT, STLE, STGE, STEQ,
+STNE, STNEAR, STMATCH };
+
+struct stnode
+{
+  enum SourcetableOp op;
+  int                a, b;      /* operand nodes */
+  double             value;
+  char               text[64];
+  double             best;      /* smallest distance for STNEAR */
+};
+
+struct stquery
+{
+  struct stnode node[SOURCETABLEMAXNODE];
+  int           num;
+  const char   *pos;
+  int           error;
+};
+
+static int SourcetableNode(struct stquery *q, enum SourcetableOp op, int a,
+int b)
+{
+  struct stnode *n;
+
+  if(q->num == SOURCETABLEMAXNODE)
+  {
+    q->error = 1;
+    return 0;
+  }
+  n = &q->node[q->num];
+  memset(n, 0, sizeof(*n));
+  n->op = op;
+  n->a = a;
+  n->b = b;
+  return q->num++;
+}
+
+static int SourcetableOr(struct stquery *q);
+
+static int SourcetableAtom(struct stquery *q)
+{
+  static const struct { const char *text; enum SourcetableOp op; } ops[] = {
+  {"!=", STNE}, {"<=", STLE}, {"=<", STLE}, {">=", STGE}, {"=>", STGE},
+  {"<", STLT}, {">", STGT}, {"=", STEQ}, {"~", STNEAR}};
+  const char *s = q->pos;
+  unsigned int i;
+  int n;
+
+  if(*s == '!' && s[1] != '=')
+  {
+    ++q->pos;
+    return SourcetableNode(q, STNOT, SourcetableAtom(q), 0);
+  }
+  if(*s == '(')
+  {
+    ++q->pos;
+    n = SourcetableOr(q);
+    if(*q->pos != ')')
+      q->error = 1;
+    else
+      ++q->pos;
+    return n;
+  }
+  for(i = 0; i < sizeof(ops)/sizeof(ops[0]); ++i)
+  {
+    int l = strlen(ops[i].text);
+    if(!strncmp(s, ops[i].text, l))
+    {
+      char *e;
+      n = SourcetableNode(q, ops[i].op, 0, 0);
+      q->node[n].value = strtod(s+l, &e);
+      if(e == s+l)
+        q->error = 1;
+      q->pos = e;
+      return n;
+    }
+  }
+  n = SourcetableNode(q, STMATCH, 0, 0);
+  for(i = 0; *s && *s != '|' && *s != '&' && *s != ')'; ++s)
+  {
+    if(i < sizeof(q->node[n].text)-1)
+      q->node[n].text[i++] = *s;
+    else
+      q->error = 1;
+  }
+  q->node[n].text[i] = 0;
+  q->pos = s;
+  return n;
+}
+
+static int SourcetableAnd(struct stquery *q)
+{
+  int n = SourcetableAtom(q);
+  while(*q->pos == '&' && !q->error)
+  {
+    ++q->pos;
+    n = SourcetableNode(q, STAND, n, SourcetableAtom(q));
+  }
+  return n;
+}
+
+static int SourcetableOr(struct stquery *q)
+{
+  int n = SourcetableAnd(q);
+  while(*q->pos == '|' && !q->error)
+  {
+    ++q->pos;
+    n = SourcetableNode(q, STOR, n, SourcetableAnd(q));
+  }
+  return n;
+}
+
+/* compiles the query of one field, returns the top node or -1 on syntax
+   errors */
+static int SourcetableCompile(struct stquery *q, const char *field)
+{
+  int n;
+
+  q->num = 0;
+  q->error = 0;
+  q->pos = field;
+  n = SourcetableOr(q);
+  return q->error || *q->pos ? -1 : n;
+}
+
+static int SourcetableWildcard(const char *p, const char *s)
+{
+  for(; *p; ++p, ++s)
+  {
+    if(*p == '*')
+    {
+      while(*++p == '*')
+        ;
+      if(!*p)
+        return 1;
+      for(; *s; ++s)
+      {
+        if(SourcetableWildcard(p, s))
+          return 1;
+      }
+      return 0;
+    }
+    if(tolower((unsigned char)*p) != tolower((unsigned char)*s))
+      return 0;
+  }
+  return !*s;
+}
+
+/* returns 0 when the text is no number */
+static int SourcetableNumber(const char *s, double *v)
+{
+  char *e;
+  *v = strtod(s, &e);
+  while(*e == ' ')
+    ++e;
+  return e != s && !*e;
+}
+
+/* evaluates node n for a value, STNEAR is true when near is 0, else when
+   the value has the smallest distance */
+static int SourcetableEval(const struct stquery *q, int n, const char *s,
+int near)
+{
+  const struct stnode *d = &q->node[n];
+  double v;
+
+  switch(d->op)
+  {
+  case STOR:
+    return SourcetableEval(q, d->a, s, near)
+    || SourcetableEval(q, d->b, s, near);
+  case STAND:
+    return SourcetableEval(q, d->a, s, near)
+    && SourcetableEval(q, d->b, s, near);
+  case STNOT:
+    return !SourcetableEval(q, d->a, s, near);
+  case STMATCH:
+    return SourcetableWildcard(d->text, s);
+  default:
+    break;
+  }
+  if(!SourcetableNumber(s, &v))
+    return 0;
+  switch(d->op)
+  {
+  case STLT: return v < d->value;
+  case STGT: return v > d->value;
+  case STLE: return v <= d->value;
+  case STGE: return v >= d->value;
+  case STEQ: return v == d->value;
+  case STNE: return v != d->value;
+  case STNEAR:
+    return !near || (v > d->value ? v-d->value : d->value-v) <= d->best;
+  default:
+    return 0;
+  }
+}
+
+/* Selects the lines matching the query "?field;field;...", which is
+   evaluated column by column. Lines with the smallest distance for an
+   operator ~ are found in a second pass over the lines selected in the
+   first one. Returns the number of selected lines or -1 on syntax
+   errors. */
+static int SourcetableQuery(const struct sourcetable *t, const char *query,
+unsigned char *select)
+{
+  struct stquery q;
+  int c, r, top, num = t->lines;
+
+  memset(select, 1, t->lines);
+  if(!query)
+    return num;
+  if(*query == '?')
+    ++query;
+  for(c = 0; *query; ++c)
+  {
+    char field[SOURCETABLEMAXLINE];
+    const char *e = strchr(query, ';');
+    int n = e ? e-query : (int)strlen(query), near = 0, pass;
+
+    if(n >= (int)sizeof(field))
+      return -1;
+    memcpy(field, query, n);
+    field[n] = 0;
+    query += e ? n+1 : n;
+    if(!n)
+      continue;
+    if((top = SourcetableCompile(&q, field)) < 0)
+      return -1;
+    for(r = 0; r < q.num; ++r)
+    {
+      if(q.node[r].op == STNEAR)
+      {
+        near = 1;
+        q.node[r].best = -1;
+      }
+    }
+    for(pass = 0; pass <= near; ++pass)
+    {
+      for(r = 0, num = 0; r < t->lines; ++r)
+      {
+        if(!select[r] || !(select[r] = SourcetableEval(&q, top,
+        SourcetableCell(t, c, r), pass)))
+          continue;
+        ++num;
+        if(!pass && near)
+        {
+          /* distances of the values to the nearest value searched */
+          double v;
+          int k;
+          for(k = 0; k < q.num; ++k)
+          {
+            struct stnode *d = &q.node[k];
+            if(d->op == STNEAR && SourcetableNumber(SourcetableCell(t, c, r), &v))
+            {
+              v = v > d->value ? v-d->value : d->value-v;
+              if(d->best < 0 || v < d->best)
+                d->best = v;
+            }
+          }
+        }
+      }
+    }
+  }
+  return num;
+}
+
+static void SourcetablePrint(const struct sourcetable *t,
+const unsigned char *select, FILE *f)
+{
+  int r, c;
+
+  for(r = 0; r < t->lines; ++r)
+  {
+    if(!select[r])
+      continue;
+    for(c = 0; c < t->fields[r]; ++c)
+      fprintf(f, "%s%s", c ? ";" : "", SourcetableCell(t, c, r));
+    fputs("\r\n", f);
+  }
+  fputs("ENDSOURCETABLE\r\n", f);
+}
+
+/* Spatial index of the STR records. The positions are points on the unit
+   sphere, so their straight distance grows with the distance on earth
+   also across the poles and the date line. The points are kept in a k-d
+   tree stored in an array, where the middle element of a range splits
+   it at the axis given by the depth. */
+#define SOURCETABLELAT     9      /* fields of STR records */
+#define SOURCETABLELON     10
+#define SOURCETABLEMAXNEAR 16
+#define SOURCETABLERADIUS  6371.0 /* km */
+#define SOURCETABLERAD     (3.14159265358979323846/180.0)
+
+struct stpoint
+{
+  double x[3];
+  int    line;
+};
+
+struct stindex
+{
+  struct stpoint *point;
+  int             num;
+};
+
+struct stnear
+{
+  int    num;
+  int    max;
+  double d[SOURCETABLEMAXNEAR];   /* squared distances, ascending */
+  int    line[SOURCETABLEMAXNEAR];
+};
+
+static void SourcetablePoint(double lat, double lon, double *x)
+{
+  lat *= SOURCETABLERAD;
+  lon *= SOURCETABLERAD;
+  x[0] = cos(lat)*cos(lon);
+  x[1] = cos(lat)*sin(lon);
+  x[2] = sin(lat);
+}
+
+/* moves the median of the axis to the middle of the range */
+static void SourcetableSplit(struct stpoint *p, int num, int axis)
+{
+  int lo = 0, hi = num-1, k = num/2;
+
+  while(lo < hi)
+  {
+    double pivot = p[(lo+hi)/2].x[axis];
+    int i = lo, j = hi;
+    while(i <= j)
+    {
+      while(p[i].x[axis] < pivot)
+        ++i;
+      while(p[j].x[axis] > pivot)
+        --j;
+      if(i <= j)
+      {
+        struct stpoint s = p[i];
+        p[i++] = p[j];
+        p[j--] = s;
+      }
+    }
+    if(k <= j)
+      hi = j;
+    else if(k >= i)
+      lo = i;
+    else
+      break;
+  }
+}
+
+static void SourcetableBuild(struct stpoint *p, int num, int depth)
+{
+  while(num > 1)
+  {
+    SourcetableSplit(p, num, depth%3);
+    SourcetableBuild(p, num/2, depth+1);
+    p += num/2+1;
+    num -= num/2+1;
+    ++depth;
+  }
+}
+
+/* indexes the selected STR records with a valid position, returns 0 when
+   memory is missing */
+static int SourcetableIndex(struct stindex *x, const struct sourcetable *t,
+const unsigned char *select)
+{
+  int r;
+
+  x->num = 0;
+  if(!(x->point = malloc((t->lines+1)*sizeof(*x->point))))
+    return 0;
+  for(r = 0; r < t->lines; ++r)
+  {
+    double lat, lon;
+    if(select[r] && !strcmp(SourcetableCell(t, 0, r), "STR")
+    && SourcetableNumber(SourcetableCell(t, SOURCETABLELAT, r), &lat)
+    && SourcetableNumber(SourcetableCell(t, SOURCETABLELON, r), &lon)
+    && lat >= -90 && lat <= 90)
+    {
+      SourcetablePoint(lat, lon, x->point[x->num].x);
+      x->point[x->num++].line = r;
+    }
+  }
+  SourcetableBuild(x->point, x->num, 0);
+  return 1;
+}
+
+static void SourcetableIndexFree(struct stindex *x)
+{
+  free(x->point);
+  x->point = 0;
+  x->num = 0;
+}
+
+static void SourcetableSearch(const struct stpoint *p, int num, int depth,
+const double *q, struct stnear *n)
+{
+  while(num > 0)
+  {
+    int m = num/2, axis = depth%3, i;
+    double diff = q[axis]-p[m].x[axis], d = 0;
+
+    for(i = 0; i < 3; ++i)
+      d += (q[i]-p[m].x[i])*(q[i]-p[m].x[i]);
+    if(n->num < n->max || d < n->d[n->num-1])
+    {
+      /* insert sorted, the farthest one falls out when the list is full */
+      if(n->num < n->max)
+        ++n->num;
+      for(i = n->num-1; i > 0 && n->d[i-1] > d; --i)
+      {
+        n->d[i] = n->d[i-1];
+        n->line[i] = n->line[i-1];
+      }
+      n->d[i] = d;
+      n->line[i] = p[m].line;
+    }
+    /* the side of the query point first, the other one only when it may
+       hold a nearer point */
+    if(diff < 0)
+    {
+      SourcetableSearch(p, m, depth+1, q, n);
+      p += m+1;
+      num -= m+1;
+    }
+    else
+    {
+      SourcetableSearch(p+m+1, num-m-1, depth+1, q, n);
+      num = m;
+    }
+    if(n->num == n->max && diff*diff >= n->d[n->num-1])
+      break;
+    ++depth;
+  }
+}
+
+/* finds up to max records nearest to the position in degrees, the lines
+   and distances in km are stored ascending, returns their number */
+static int SourcetableNearest(const struct stindex *x, double lat, double lon,
+int max, int *line, double *km)
+{
+  struct stnear n;
+  double q[3];
+  int i;
+
+  n.num = 0;
+  n.max = max < SOURCETABLEMAXNEAR ? max : SOURCETABLEMAXNEAR;
+  SourcetablePoint(lat, lon, q);
+  SourcetableSearch(x->point, x->num, 0, q, &n);
+  for(i = 0; i < n.num; ++i)
+  {
+    line[i] = n.line[i];
+    km[i] = 2*SOURCETABLERADIUS*asin(sqrt(n.d[i])/2);
+  }
+  return n.num;
+}
+
+/* returns the distance in km between two positions in degrees */
+static double SourcetableKm(double lat1, double lon1, double lat2,
+double lon2)
+{
+  double a[3], b[3], d = 0;
+  int i;
+
+  SourcetablePoint(lat1, lon1, a);
+  SourcetablePoint(lat2, lon2, b);
+  for(i = 0; i < 3; ++i)
+    d += (a[i]-b[i])*(a[i]-b[i]);
+  return 2*SOURCETABLERADIUS*asin(sqrt(d)/2);
+}
+
+/* returns the distance in km of a record to the position in degrees or
+   -1 when the record has no position */
+static double SourcetableDistance(const struct sourcetable *t, int line,
+double lat, double lon)
+{
+  double l, o;
+
+  if(!SourcetableNumber(SourcetableCell(t, SOURCETABLELAT, line), &l)
+  || !SourcetableNumber(SourcetableCell(t, SOURCETABLELON, line), &o))
+    return -1;
+  return SourcetableKm(l, o, lat, lon);
+}